@@ -0,0 +1,180 @@
+#include <iostream>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "acceptor_group.h"
+#include "event_loop.h"
+#include "listener.h"
+#include "uring_loop.h"
+
+// Keeps a loop (and the sockets it owns) on one core so its caches stay warm
+static void pinToCore(std::thread &t, size_t core)
+{
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core, &cpus);
+    int rc = pthread_setaffinity_np(t.native_handle(), sizeof(cpus), &cpus);
+    if (rc != 0)
+    {
+        std::cerr << "Failed to pin acceptor to core " << core << ": " << strerror(rc) << std::endl;
+    }
+}
+
+// Builds a loop on the requested backend, falling back to epoll when the
+// kernel cannot run the io_uring one
+static std::unique_ptr<ServerLoop> createLoop(IoBackend backend, int listen_s, WorkerPool &workers,
+                                              const LoopLimits &limits)
+{
+    if (backend == IoBackend::IoUring)
+    {
+        std::unique_ptr<ServerLoop> loop = std::make_unique<UringLoop>(listen_s, workers, limits);
+        if (loop->init())
+        {
+            return loop;
+        }
+        std::cerr << "io_uring backend unavailable, falling back to epoll" << std::endl;
+    }
+
+    std::unique_ptr<ServerLoop> loop = std::make_unique<EventLoop>(listen_s, workers, limits);
+    if (!loop->init())
+    {
+        return nullptr;
+    }
+    return loop;
+}
+
+AcceptorGroup::AcceptorGroup(const ServerConfig &config, CommandContext &ctx)
+    : config(config), ctx(ctx)
+{
+}
+
+AcceptorGroup::~AcceptorGroup()
+{
+    stopAll();
+    wait();
+    for (auto &acceptor : acceptors)
+    {
+        if (acceptor->listen_s >= 0)
+        {
+            close(acceptor->listen_s);
+        }
+    }
+    if (!config.unixSocket.empty())
+    {
+        unlink(config.unixSocket.c_str());
+    }
+}
+
+bool AcceptorGroup::start()
+{
+    size_t count = config.acceptors > 0 ? config.acceptors : 1;
+    bool reusePort = count > 1;
+
+    // Split the worker threads between the acceptors; each gets at least one
+    size_t workersEach = config.workerThreads / count;
+    if (workersEach == 0)
+    {
+        workersEach = 1;
+    }
+
+    // Each loop admits its share of the connection limit
+    LoopLimits limits;
+    limits.maxConnections = config.maxConnections / count;
+    if (limits.maxConnections == 0)
+    {
+        limits.maxConnections = 1;
+    }
+    limits.outputHighWater = config.outputHighWater;
+    limits.outputLowWater = config.outputLowWater;
+    limits.idleTimeoutMs = config.idleTimeoutMs;
+    limits.requestTimeoutMs = config.requestTimeoutMs;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        auto acceptor = std::make_unique<Acceptor>();
+        acceptor->listen_s = openTcpListener(config.port, config.backlog, reusePort);
+        if (acceptor->listen_s < 0)
+        {
+            return false;
+        }
+
+        acceptor->workers = std::make_unique<WorkerPool>(workersEach, config.queueDepth, ctx);
+        acceptor->loop = createLoop(config.ioBackend, acceptor->listen_s, *acceptor->workers, limits);
+        if (!acceptor->loop)
+        {
+            close(acceptor->listen_s);
+            return false;
+        }
+
+        // SHUTDOWN on any connection stops every loop in the group
+        acceptor->loop->setShutdownHandler([this]
+                                           { stopAll(); });
+        acceptors.push_back(std::move(acceptor));
+    }
+
+    // Co-located clients get their own epoll loop on the Unix socket; it is
+    // the backend that watches the shared-memory rings' eventfds
+    if (!config.unixSocket.empty())
+    {
+        auto acceptor = std::make_unique<Acceptor>();
+        acceptor->listen_s = openUnixListener(config.unixSocket, config.backlog);
+        if (acceptor->listen_s < 0)
+        {
+            return false;
+        }
+
+        LoopLimits unixLimits = limits;
+        unixLimits.idleTimeoutMs = config.unixIdleTimeoutMs;
+        unixLimits.requestTimeoutMs = config.unixRequestTimeoutMs;
+
+        acceptor->workers = std::make_unique<WorkerPool>(workersEach, config.queueDepth, ctx);
+        acceptor->loop = std::make_unique<EventLoop>(acceptor->listen_s, *acceptor->workers, unixLimits, true);
+        if (!acceptor->loop->init())
+        {
+            close(acceptor->listen_s);
+            return false;
+        }
+        acceptor->loop->setShutdownHandler([this]
+                                           { stopAll(); });
+        acceptors.push_back(std::move(acceptor));
+        std::cout << "Local clients can connect on " << config.unixSocket << std::endl;
+    }
+
+    size_t cores = std::thread::hardware_concurrency();
+    for (size_t i = 0; i < acceptors.size(); i++)
+    {
+        Acceptor &acceptor = *acceptors[i];
+        acceptor.workers->start();
+        acceptor.thread = std::thread([&acceptor]
+                                      { acceptor.loop->run(); });
+        if (reusePort && cores > 0)
+        {
+            pinToCore(acceptor.thread, i % cores);
+        }
+    }
+
+    std::cout << "Server listening on port " << config.port << " with " << count
+              << (reusePort ? " SO_REUSEPORT acceptor(s)" : " acceptor") << "..." << std::endl;
+    return true;
+}
+
+void AcceptorGroup::wait()
+{
+    for (auto &acceptor : acceptors)
+    {
+        if (acceptor->thread.joinable())
+        {
+            acceptor->thread.join();
+        }
+        acceptor->workers->stop();
+    }
+}
+
+void AcceptorGroup::stopAll()
+{
+    for (auto &acceptor : acceptors)
+    {
+        acceptor->loop->stop();
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef ACCEPTOR_GROUP_H
+#define ACCEPTOR_GROUP_H
+
+#include <memory>
+#include <thread>
+#include <vector>
+#include "server_loop.h"
+#include "server_config.h"
+#include "thread_pool.h"
+
+struct CommandContext;
+
+// Runs config.acceptors independent server loops on the configured I/O
+// backend. With more than one, every loop opens its own SO_REUSEPORT
+// listener on the same port and is pinned to a core; it accepts, reads,
+// executes (on its own worker pool) and answers its connections without
+// sharing any state with the other loops. A configured Unix socket gets one
+// more epoll loop of its own, which can move clients onto shared memory.
+// All worker pools share the one set of database connections and trade
+// committer in ctx.
+class AcceptorGroup
+{
+public:
+    AcceptorGroup(const ServerConfig &config, CommandContext &ctx);
+    ~AcceptorGroup();
+
+    bool start();
+    void wait();
+    void stopAll();
+
+private:
+    struct Acceptor
+    {
+        int listen_s = -1;
+        std::unique_ptr<WorkerPool> workers;
+        std::unique_ptr<ServerLoop> loop;
+        std::thread thread;
+    };
+
+    const ServerConfig &config;
+    CommandContext &ctx;
+    std::vector<std::unique_ptr<Acceptor>> acceptors;
+};
+
+#endif
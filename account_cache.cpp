@@ -0,0 +1,311 @@
+#include "account_cache.h"
+
+// Fibonacci hashing spreads the small, dense symbol IDs over the table
+size_t PositionMap::homeOf(uint32_t symbol, size_t mask)
+{
+    return (size_t)(((uint64_t)symbol * 0x9E3779B97F4A7C15ull) >> 40) & mask;
+}
+
+size_t PositionMap::slotFor(uint32_t symbol) const
+{
+    size_t mask = slots.size() - 1;
+    size_t i = homeOf(symbol, mask);
+    while (slots[i].symbol != SYMBOL_NONE && slots[i].symbol != symbol)
+    {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+const int64_t *PositionMap::find(uint32_t symbol) const
+{
+    if (slots.empty())
+    {
+        return nullptr;
+    }
+    const Slot &slot = slots[slotFor(symbol)];
+    return slot.symbol == SYMBOL_NONE ? nullptr : &slot.micros;
+}
+
+void PositionMap::set(uint32_t symbol, int64_t micros)
+{
+    // Keep at least half the slots free so probe runs stay short
+    if ((count + 1) * 2 > slots.size())
+    {
+        grow();
+    }
+    Slot &slot = slots[slotFor(symbol)];
+    if (slot.symbol == SYMBOL_NONE)
+    {
+        slot.symbol = symbol;
+        count++;
+    }
+    slot.micros = micros;
+}
+
+void PositionMap::erase(uint32_t symbol)
+{
+    if (slots.empty())
+    {
+        return;
+    }
+    size_t mask = slots.size() - 1;
+    size_t hole = slotFor(symbol);
+    if (slots[hole].symbol == SYMBOL_NONE)
+    {
+        return;
+    }
+    slots[hole] = Slot();
+    count--;
+
+    // Pull later entries of the probe run back over the hole, unless their
+    // home slot lies after it, so lookups never stop early at a gap
+    for (size_t j = (hole + 1) & mask; slots[j].symbol != SYMBOL_NONE; j = (j + 1) & mask)
+    {
+        size_t home = homeOf(slots[j].symbol, mask);
+        bool stays = hole <= j ? (hole < home && home <= j) : (hole < home || home <= j);
+        if (!stays)
+        {
+            slots[hole] = slots[j];
+            slots[j] = Slot();
+            hole = j;
+        }
+    }
+}
+
+void PositionMap::grow()
+{
+    std::vector<Slot> old;
+    old.swap(slots);
+    slots.resize(old.empty() ? 8 : old.size() * 2);
+    for (const Slot &slot : old)
+    {
+        if (slot.symbol != SYMBOL_NONE)
+        {
+            slots[slotFor(slot.symbol)] = slot;
+        }
+    }
+}
+
+AccountCache::AccountCache(size_t shards)
+    : shardCount(shards > 0 ? shards : 1), positionShards(new PositionShard[shardCount])
+{
+}
+
+bool AccountCache::addUser(int user_id, const std::string &first_name, const std::string &last_name, int64_t usd_cents)
+{
+    if (user_id <= 0 || user_id > ACCOUNT_CACHE_MAX_ID)
+    {
+        return false;
+    }
+
+    if ((size_t)user_id >= accounts.size())
+    {
+        accounts.resize((size_t)user_id + 1);
+    }
+    Account &account = accounts[user_id];
+    if (!account.exists)
+    {
+        account.exists = true;
+        userCount++;
+    }
+    account.first_name = first_name;
+    account.last_name = last_name;
+    account.balance.cents.store(usd_cents, std::memory_order_relaxed);
+    account.available.cents.store(usd_cents, std::memory_order_relaxed);
+    return true;
+}
+
+bool AccountCache::addPosition(int user_id, uint32_t symbol, int64_t micros)
+{
+    if (user_id <= 0 || (size_t)user_id >= accounts.size() || !accounts[user_id].exists || symbol == SYMBOL_NONE)
+    {
+        return false;
+    }
+    if (micros != 0)
+    {
+        setPosition(user_id, symbol, micros);
+    }
+    return true;
+}
+
+const AccountCache::Account *AccountCache::find(int user_id) const
+{
+    if (user_id > 0 && (size_t)user_id < accounts.size() && accounts[user_id].exists)
+    {
+        hitCount.fetch_add(1, std::memory_order_relaxed);
+        return &accounts[user_id];
+    }
+    missCount.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+}
+
+AccountCache::Account *AccountCache::find(int user_id)
+{
+    return const_cast<Account *>(static_cast<const AccountCache *>(this)->find(user_id));
+}
+
+bool AccountCache::user(int user_id, std::string &first_name, std::string &last_name, int64_t &usd_cents) const
+{
+    const Account *account = find(user_id);
+    if (!account)
+    {
+        return false;
+    }
+    first_name = account->first_name;
+    last_name = account->last_name;
+    usd_cents = account->balance.cents.load(std::memory_order_acquire);
+    return true;
+}
+
+bool AccountCache::cash(int user_id, int64_t &usd_cents) const
+{
+    const Account *account = find(user_id);
+    if (!account)
+    {
+        return false;
+    }
+    usd_cents = account->balance.cents.load(std::memory_order_acquire);
+    return true;
+}
+
+bool AccountCache::reserveCash(int user_id, int64_t cents)
+{
+    Account *account = find(user_id);
+    if (!account)
+    {
+        return false;
+    }
+    std::atomic<int64_t> &available = account->available.cents;
+    int64_t free = available.load(std::memory_order_relaxed);
+    do
+    {
+        if (free < cents)
+        {
+            return false;
+        }
+    } while (!available.compare_exchange_weak(free, free - cents, std::memory_order_acq_rel, std::memory_order_relaxed));
+    return true;
+}
+
+void AccountCache::releaseCash(int user_id, int64_t cents)
+{
+    Account *account = find(user_id);
+    if (account && cents != 0)
+    {
+        account->available.cents.fetch_add(cents, std::memory_order_acq_rel);
+    }
+}
+
+int64_t AccountCache::freeCash(int user_id) const
+{
+    const Account *account = find(user_id);
+    return account ? account->available.cents.load(std::memory_order_acquire) : 0;
+}
+
+int64_t AccountCache::position(int user_id, uint32_t symbol) const
+{
+    const PositionShard &shard = positionShards[shardOf(symbol, shardCount)];
+    if (user_id <= 0 || (size_t)user_id >= shard.users.size())
+    {
+        return 0;
+    }
+    const int64_t *micros = shard.users[user_id].find(symbol);
+    return micros ? *micros : 0;
+}
+
+void AccountCache::setPosition(int user_id, uint32_t symbol, int64_t micros)
+{
+    PositionShard &shard = positionShards[shardOf(symbol, shardCount)];
+    if ((size_t)user_id >= shard.users.size())
+    {
+        shard.users.resize(accounts.size());
+    }
+    PositionMap &positions = shard.users[user_id];
+    size_t before = positions.size();
+    if (micros == 0)
+    {
+        positions.erase(symbol);
+    }
+    else
+    {
+        positions.set(symbol, micros);
+    }
+    shard.count.fetch_add(positions.size() - before, std::memory_order_relaxed);
+}
+
+size_t AccountCache::positions() const
+{
+    size_t total = 0;
+    for (size_t i = 0; i < shardCount; i++)
+    {
+        total += positionShards[i].count.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+bool AccountBatch::cash(int user_id, int64_t &usd_cents) const
+{
+    if (!cache.cash(user_id, usd_cents))
+    {
+        return false;
+    }
+    auto it = cashChanges.find(user_id);
+    if (it != cashChanges.end())
+    {
+        usd_cents += it->second.credited - it->second.spent;
+    }
+    return true;
+}
+
+int64_t AccountBatch::position(int user_id, uint32_t symbol) const
+{
+    auto it = positionChanges.find(balanceKey(user_id, symbol));
+    if (it != positionChanges.end())
+    {
+        return it->second;
+    }
+    return cache.position(user_id, symbol);
+}
+
+void AccountBatch::spendCash(int user_id, int64_t cents)
+{
+    cashChanges[user_id].spent += cents;
+}
+
+void AccountBatch::creditCash(int user_id, int64_t cents)
+{
+    cashChanges[user_id].credited += cents;
+}
+
+void AccountBatch::setPosition(int user_id, uint32_t symbol, int64_t micros)
+{
+    positionChanges[balanceKey(user_id, symbol)] = micros;
+}
+
+void AccountBatch::publish()
+{
+    for (auto &change : cashChanges)
+    {
+        AccountCache::Account &account = cache.accounts[change.first];
+        account.balance.cents.fetch_add(change.second.credited - change.second.spent, std::memory_order_acq_rel);
+        account.available.cents.fetch_add(change.second.credited, std::memory_order_acq_rel); // Spending was reserved already
+    }
+    for (auto &change : positionChanges)
+    {
+        cache.setPosition(balanceUser(change.first), balanceSymbol(change.first), change.second);
+    }
+    cashChanges.clear();
+    positionChanges.clear();
+}
+
+void AccountBatch::discard()
+{
+    // What was reserved to be spent is free again
+    for (auto &change : cashChanges)
+    {
+        cache.releaseCash(change.first, change.second.spent);
+    }
+    cashChanges.clear();
+    positionChanges.clear();
+}
@@ -0,0 +1,187 @@
+#ifndef ACCOUNT_CACHE_H
+#define ACCOUNT_CACHE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "symbol_table.h"
+
+// Largest user ID the cache will hold. Accounts live in an array indexed by
+// ID, so this bounds its size (IDs come from AUTOINCREMENT and stay small).
+#define ACCOUNT_CACHE_MAX_ID 16777216
+
+// (user, symbol ID) packed into one integer key; symbol SYMBOL_NONE is the
+// user's cash balance
+inline uint64_t balanceKey(int user_id, uint32_t symbol) { return ((uint64_t)(uint32_t)user_id << 32) | symbol; }
+inline int balanceUser(uint64_t key) { return (int)(key >> 32); }
+inline uint32_t balanceSymbol(uint64_t key) { return (uint32_t)key; }
+
+// One user's positions: symbol ID -> micro-shares, in a single
+// open-addressed array (linear probing, power-of-two capacity) rather than
+// a node per entry. Users hold a handful of symbols, so a lookup is usually
+// one probe into memory that is already in cache.
+class PositionMap
+{
+public:
+    // Null if the user holds none of symbol
+    const int64_t *find(uint32_t symbol) const;
+    void set(uint32_t symbol, int64_t micros);
+    void erase(uint32_t symbol);
+
+    size_t size() const { return count; }
+
+private:
+    struct Slot
+    {
+        uint32_t symbol = SYMBOL_NONE; // SYMBOL_NONE marks a free slot
+        int64_t micros = 0;
+    };
+
+    static size_t homeOf(uint32_t symbol, size_t mask);
+    size_t slotFor(uint32_t symbol) const;
+    void grow();
+
+    std::vector<Slot> slots;
+    size_t count = 0;
+};
+
+// A cash amount every shard may read and change at once. It is only
+// copyable so the account array can grow while accounts are loaded,
+// before any other thread runs.
+struct CashBalance
+{
+    std::atomic<int64_t> cents{0};
+
+    CashBalance() = default;
+    CashBalance(const CashBalance &other) : cents(other.cents.load(std::memory_order_relaxed)) {}
+    CashBalance &operator=(const CashBalance &other)
+    {
+        cents.store(other.cents.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        return *this;
+    }
+};
+
+// The authoritative copy of every account: loaded from SQLite at startup,
+// then used for all balance reads and pre-trade checks. SQLite only sees
+// writes, in the trade's own transaction or later (see TradeExecutor).
+//
+// Symbols are split across shards (see shardOf()), each run by its own
+// engine thread, so a position is only ever touched by its symbol's shard
+// and positions are kept per shard without any locking. Cash is shared by
+// every shard, so it follows a reservation protocol instead: each user has
+// a committed balance and the part of it that is free. A trade first
+// reserves what it may pay out of the free cash with one atomic
+// compare-and-swap, which fails rather than let two shards spend the same
+// cents; then, through an AccountBatch, it spends (part of) the
+// reservation, returns the rest, or credits proceeds. Proceeds only become
+// free once the trade has committed. No trade waits for another shard.
+// Users and names never change after loading, so reading them is lock-free
+// as well.
+class AccountCache
+{
+public:
+    explicit AccountCache(size_t shards = 1);
+
+    AccountCache(const AccountCache &) = delete;
+    AccountCache &operator=(const AccountCache &) = delete;
+
+    // Used while loading from the database, before any other thread runs
+    bool addUser(int user_id, const std::string &first_name, const std::string &last_name, int64_t usd_cents);
+    bool addPosition(int user_id, uint32_t symbol, int64_t micros);
+
+    // Committed balance; false if there is no such user
+    bool user(int user_id, std::string &first_name, std::string &last_name, int64_t &usd_cents) const;
+    bool cash(int user_id, int64_t &usd_cents) const;
+
+    // Takes cents out of user_id's free cash; false if there is no such
+    // user or not that much is free. releaseCash() hands back what a trade
+    // reserved but will not spend.
+    bool reserveCash(int user_id, int64_t cents);
+    void releaseCash(int user_id, int64_t cents);
+    int64_t freeCash(int user_id) const;
+
+    // Micro-shares of symbol held by user_id; 0 if none. Only called from
+    // symbol's shard.
+    int64_t position(int user_id, uint32_t symbol) const;
+
+    size_t shards() const { return shardCount; }
+    size_t users() const { return userCount; }
+    size_t positions() const;
+    uint64_t hits() const { return hitCount.load(std::memory_order_relaxed); }
+    uint64_t misses() const { return missCount.load(std::memory_order_relaxed); }
+
+private:
+    friend class AccountBatch;
+
+    struct Account
+    {
+        bool exists = false;
+        std::string first_name;
+        std::string last_name;
+        CashBalance balance;   // Committed
+        CashBalance available; // balance less what is reserved
+    };
+
+    // The positions of one shard's symbols
+    struct PositionShard
+    {
+        std::vector<PositionMap> users; // Indexed by user ID
+        std::atomic<size_t> count{0};
+    };
+
+    const Account *find(int user_id) const;
+    Account *find(int user_id);
+    void setPosition(int user_id, uint32_t symbol, int64_t micros);
+
+    std::vector<Account> accounts; // Indexed by user ID
+    size_t userCount = 0;
+    size_t shardCount;
+    std::unique_ptr<PositionShard[]> positionShards;
+
+    // Account lookups that found the user, and those that did not
+    mutable std::atomic<uint64_t> hitCount{0};
+    mutable std::atomic<uint64_t> missCount{0};
+};
+
+// Changes made by one group of trades on one shard. Reads see the group's
+// own earlier changes, so trades in a group build on each other, but other
+// threads only see them once publish() runs after the group has committed.
+// discard() drops them when the transaction was rolled back, returning the
+// cash they were going to spend to the free balance.
+class AccountBatch
+{
+public:
+    explicit AccountBatch(AccountCache &cache) : cache(cache) {}
+
+    // Committed balance with this batch's changes
+    bool cash(int user_id, int64_t &usd_cents) const;
+    int64_t position(int user_id, uint32_t symbol) const;
+
+    // Go straight to the cache (see AccountCache)
+    bool reserveCash(int user_id, int64_t cents) { return cache.reserveCash(user_id, cents); }
+    void releaseCash(int user_id, int64_t cents) { cache.releaseCash(user_id, cents); }
+
+    void spendCash(int user_id, int64_t cents); // Out of an earlier reservation
+    void creditCash(int user_id, int64_t cents);
+    void setPosition(int user_id, uint32_t symbol, int64_t micros); // 0 closes it
+
+    void publish();
+    void discard();
+
+private:
+    struct CashChange
+    {
+        int64_t spent = 0;
+        int64_t credited = 0;
+    };
+
+    AccountCache &cache;
+    std::unordered_map<int, CashChange> cashChanges;
+    std::unordered_map<uint64_t, int64_t> positionChanges; // By balanceKey()
+};
+
+#endif
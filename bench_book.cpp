@@ -0,0 +1,162 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include "account_cache.h"
+#include "fixed_point.h"
+#include "matching_engine.h"
+#include "order_book.h"
+
+// Drives one OrderBook with a random stream of limit orders around a
+// moving mid price, the way a busy symbol would see them, with cancels of
+// recent orders mixed in as market makers send them, and reports how many
+// it handled per second. Usage: bench_book [orders] [seed]
+//
+// Before timing anything it checks that BookEngine rejects a REPLACE the
+// user cannot pay for without touching the original order or its hold.
+
+#define DEFAULT_ORDERS 5000000
+#define PRICE_SPREAD 50 // Cents either side of the mid an order may be priced
+#define MAX_LOTS 10     // Orders are 1 to MAX_LOTS whole shares
+#define CANCEL_EVERY 4  // One order in this many is followed by a cancel...
+#define CANCEL_BACK 64  // ...of one of the orders this far back, if it still rests
+
+// xorshift64*, so every run with the same seed sees the same orders
+static uint64_t nextRandom(uint64_t &state)
+{
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 2685821657736338717ULL;
+}
+
+// Accepts every balance; the check only looks at the account cache
+class NullSink : public BalanceSink
+{
+public:
+    bool addCash(int, int64_t) override { return true; }
+    bool writePosition(int, uint32_t, int64_t) override { return true; }
+};
+
+// Runs one trade the way an executor does, keeping its changes only if it
+// succeeded
+static bool runTrade(BookEngine &engine, AccountCache &cache, Trade &trade)
+{
+    NullSink sink;
+    AccountBatch batch(cache);
+    bool ok = engine.run(trade, batch, sink);
+    if (ok)
+    {
+        batch.publish();
+    }
+    else
+    {
+        batch.discard();
+    }
+    return ok;
+}
+
+// A $100 user rests a bid for 10 shares at $5, then tries to replace it
+// with one at $20. The replace must fail, leave $50 held, and the original
+// order must still be there to cancel, which frees the rest.
+static bool checkRejectedReplace()
+{
+    AccountCache cache;
+    cache.addUser(1, "Bench", "User", 10000);
+    BookEngine engine(cache, 1);
+
+    Trade bid;
+    bid.buy = true;
+    bid.symbol = "BENCH";
+    bid.symbol_id = 0;
+    bid.amount_micros = 10 * MICROS_PER_SHARE;
+    bid.price_cents = 500;
+    bid.user_id = 1;
+    if (!runTrade(engine, cache, bid) || cache.freeCash(1) != 5000)
+    {
+        std::cerr << "Replace check: the resting bid was not placed" << std::endl;
+        return false;
+    }
+
+    Trade replace = bid;
+    replace.action = OrderAction::Replace;
+    replace.target_id = bid.order_id;
+    replace.price_cents = 2000;
+    if (runTrade(engine, cache, replace) || cache.freeCash(1) != 5000)
+    {
+        std::cerr << "Replace check: an unaffordable replace changed the order's hold" << std::endl;
+        return false;
+    }
+
+    Trade cancel = bid;
+    cancel.action = OrderAction::Cancel;
+    cancel.target_id = bid.order_id;
+    if (!runTrade(engine, cache, cancel) || cache.freeCash(1) != 10000)
+    {
+        std::cerr << "Replace check: a rejected replace lost the original order" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t orders = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : DEFAULT_ORDERS;
+    uint64_t state = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 88172645463325252ULL;
+    if (orders == 0 || state == 0)
+    {
+        std::cerr << "Usage: " << argv[0] << " [orders] [seed]" << std::endl;
+        return 1;
+    }
+    if (!checkRejectedReplace())
+    {
+        return 1;
+    }
+
+    OrderBook book;
+    std::vector<Fill> fills;
+    int64_t mid = 10000; // $100.00
+    uint64_t fillCount = 0;
+    uint64_t cancelCount = 0;
+    int64_t volume = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t id = 1; id <= orders; id++)
+    {
+        uint64_t r = nextRandom(state);
+        Side side = (r & 1) ? Side::Buy : Side::Sell;
+        int64_t offset = (int64_t)((r >> 1) % (2 * PRICE_SPREAD + 1)) - PRICE_SPREAD;
+        int64_t price = mid + offset;
+        int64_t quantity = (int64_t)((r >> 16) % MAX_LOTS + 1) * MICROS_PER_SHARE;
+        int64_t hold = side == Side::Buy ? price * (quantity / MICROS_PER_SHARE) : 0;
+
+        fills.clear();
+        book.submit(id, (int32_t)(r >> 40) % 1000, side, price, quantity, hold, fills);
+        fillCount += fills.size();
+        for (const Fill &fill : fills)
+        {
+            volume += fill.quantity;
+        }
+
+        uint64_t back = (r >> 56) % CANCEL_BACK + 1;
+        if ((r >> 8) % CANCEL_EVERY == 0 && back < id && book.cancel(id - back))
+        {
+            cancelCount++;
+        }
+
+        // Let the mid wander so old levels get left behind now and then
+        if ((r >> 32) % 1000 == 0)
+        {
+            mid += (r >> 48) % 2 ? 1 : -1;
+        }
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "Orders: " << orders << " in " << elapsed << "s (" << (uint64_t)(orders / elapsed) << " orders/s)\n"
+              << "Fills: " << fillCount << ", volume: " << formatMicros(volume) << " shares, cancels: "
+              << cancelCount << "\n"
+              << "Resting: " << book.orders() << " order(s) on " << book.levels() << " level(s), best bid "
+              << formatCents(book.bestBid()) << ", best ask " << formatCents(book.bestAsk()) << std::endl;
+    return 0;
+}
@@ -1,13 +1,331 @@
 #include <iostream>
 #include <cstring>
 #include <cstdlib>
+#include <cerrno>
+#include <poll.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stdint.h>
+#include <string>
+#include <sstream>
+#include "fixed_point.h"
+#include "protocol.h"
+#include "shm_ring.h"
 using namespace std;
 
 #define SERVER_PORT 5432
 #define MAX_LINE 256
+#define FRAME_HEADER_SIZE 4
+
+// Where the client's bytes go: the socket, or once TRANSPORT SHM has been
+// accepted, the shared-memory rings (the socket then only reports hangup)
+struct Link
+{
+    int s = -1;
+    ShmChannel *shm = nullptr;
+};
+
+// Sleeps until the server signals the rings or drops the socket
+static bool waitForServer(Link &link)
+{
+    struct pollfd fds[2] = {{link.shm->clientEfd, POLLIN, 0}, {link.s, POLLIN, 0}};
+    while (poll(fds, 2, -1) < 0)
+    {
+        if (errno != EINTR)
+        {
+            return false;
+        }
+    }
+    if (fds[1].revents)
+    {
+        return false;
+    }
+    ShmChannel::drainSignal(link.shm->clientEfd);
+    return true;
+}
+
+// Sends exactly len bytes, looping over short writes
+static bool sendAll(Link &link, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        if (link.shm)
+        {
+            size_t n = link.shm->toServer.write(data, len);
+            if (n == SHM_RING_BROKEN)
+            {
+                return false;
+            }
+            if (n > 0 && link.shm->toServer.readerShouldWake())
+            {
+                ShmChannel::signal(link.shm->serverEfd);
+            }
+            data += n;
+            len -= n;
+            if (n == 0 && link.shm->toServer.parkWriter() && !waitForServer(link))
+            {
+                return false;
+            }
+            continue;
+        }
+
+        ssize_t n = send(link.s, data, len, 0);
+        if (n <= 0)
+        {
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Reads exactly len bytes; returns false if the server disconnects first
+static bool recvAll(Link &link, char *data, size_t len)
+{
+    while (len > 0)
+    {
+        if (link.shm)
+        {
+            size_t n = link.shm->toClient.read(data, len);
+            if (n == SHM_RING_BROKEN)
+            {
+                return false;
+            }
+            if (n > 0 && link.shm->toClient.writerShouldWake())
+            {
+                ShmChannel::signal(link.shm->serverEfd);
+            }
+            data += n;
+            len -= n;
+            if (n == 0 && link.shm->toClient.parkReader() && !waitForServer(link))
+            {
+                return false;
+            }
+            continue;
+        }
+
+        ssize_t n = recv(link.s, data, len, 0);
+        if (n <= 0)
+        {
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Sends one command as a length-prefixed frame
+static bool sendFrame(Link &link, const string &payload)
+{
+    uint32_t len = payload.size();
+    char header[FRAME_HEADER_SIZE] = {(char)(len >> 24), (char)(len >> 16), (char)(len >> 8), (char)len};
+    return sendAll(link, header, FRAME_HEADER_SIZE) && sendAll(link, payload.data(), payload.size());
+}
+
+// Reads one whole length-prefixed response, however large
+static bool recvFrame(Link &link, string &payload)
+{
+    unsigned char header[FRAME_HEADER_SIZE];
+    if (!recvAll(link, (char *)header, FRAME_HEADER_SIZE))
+    {
+        return false;
+    }
+    uint32_t len = ((uint32_t)header[0] << 24) | ((uint32_t)header[1] << 16) |
+                   ((uint32_t)header[2] << 8) | (uint32_t)header[3];
+    payload.resize(len);
+    return len == 0 || recvAll(link, &payload[0], len);
+}
+
+// Reads a one-line text-mode reply such as "200 OK"
+static bool recvReplyLine(Link &link, string &reply)
+{
+    char c;
+    while (recvAll(link, &c, 1))
+    {
+        if (c == '\n')
+        {
+            return true;
+        }
+        reply += c;
+    }
+    return false;
+}
+
+// Switches the connection to length-prefixed frames (binary messages when
+// binary is set). The server answers this one request in the text mode.
+static bool negotiateFraming(Link &link, bool binary)
+{
+    string request = binary ? "FRAMING BINARY\n" : "FRAMING LENGTH\n";
+    string reply;
+    return sendAll(link, request.data(), request.size()) && recvReplyLine(link, reply) &&
+           reply == "200 OK";
+}
+
+// Asks a Unix socket server for a pair of shared-memory rings. The "200 OK"
+// reply carries the ring's memfd and both eventfds; from then on link sends
+// and receives through the rings.
+static bool requestSharedMemory(Link &link, ShmChannel &channel)
+{
+    const char request[] = "TRANSPORT SHM\n";
+    if (!sendAll(link, request, sizeof(request) - 1))
+    {
+        return false;
+    }
+
+    int fds[3] = {-1, -1, -1};
+    string reply;
+    while (reply.empty() || reply.back() != '\n')
+    {
+        // One byte at a time: what follows the reply line belongs to the rings
+        char c;
+        char control[CMSG_SPACE(sizeof(fds))];
+        struct iovec iov = {&c, 1};
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t n = recvmsg(link.s, &msg, MSG_CMSG_CLOEXEC);
+        if (n <= 0)
+        {
+            return false;
+        }
+        reply += c;
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+            cmsg->cmsg_len == CMSG_LEN(sizeof(fds)))
+        {
+            memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+        }
+    }
+
+    if (reply != "200 OK\n" || fds[0] < 0 || !channel.attach(fds[0], fds[1], fds[2]))
+    {
+        return false;
+    }
+    channel.closeMemfd();
+    link.shm = &channel;
+    return true;
+}
+
+// Connects to the server's Unix domain socket at path
+static int connectUnix(const string &path)
+{
+    struct sockaddr_un sun;
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(sun.sun_path))
+    {
+        cerr << "simplex-talk: socket path too long: " << path << endl;
+        return -1;
+    }
+    memcpy(sun.sun_path, path.c_str(), path.size() + 1);
+
+    int s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s < 0)
+    {
+        perror("simplex-talk: socket");
+        return -1;
+    }
+    if (connect(s, (struct sockaddr *)&sun, sizeof(sun)) < 0)
+    {
+        perror("simplex-talk: connect");
+        close(s);
+        return -1;
+    }
+    return s;
+}
+
+// Turns a typed command into a binary message. Returns false (with a reason
+// in error) for anything the binary protocol cannot carry.
+static bool encodeBinaryCommand(const string &line, string &message, string &error)
+{
+    istringstream iss(line);
+    string command;
+    iss >> command;
+
+    if (command == "BUY" || command == "SELL")
+    {
+        string symbol, amount, price;
+        int32_t user_id;
+        int64_t quantity_micros, price_cents;
+        if (!(iss >> symbol >> amount >> price >> user_id))
+        {
+            error = "usage: " + command + " <symbol> <amount> <price> <user_id>";
+            return false;
+        }
+        if (!parseMicros(amount, quantity_micros) || !parseCents(price, price_cents))
+        {
+            error = "amounts take up to 6 decimals and prices up to 2";
+            return false;
+        }
+        if (symbol.size() > SYMBOL_LEN)
+        {
+            error = "symbols are at most " + to_string(SYMBOL_LEN) + " characters";
+            return false;
+        }
+
+        OrderRequest order{};
+        order.user_id = user_id;
+        setSymbol(order.symbol, symbol);
+        order.quantity_micros = quantity_micros;
+        order.price_cents = price_cents;
+        message = encodeOrderRequest(command == "BUY" ? MSG_BUY : MSG_SELL, order);
+        return true;
+    }
+    if (command == "BALANCE")
+    {
+        int32_t user_id = 1;
+        iss >> user_id;
+        message = encodeBalanceRequest(user_id);
+        return true;
+    }
+
+    error = "only BUY, SELL and BALANCE are available in binary mode";
+    return false;
+}
+
+// Prints a binary reply in the same shape as the text protocol's responses
+static void printBinaryReply(const string &reply)
+{
+    const MsgHeader *header = viewHeader(reply.data(), reply.size());
+    uint8_t type = header ? header->type : 0;
+
+    const OrderAck *ack;
+    const BalanceReply *balance;
+    if (type == MSG_ORDER_ACK && (ack = viewOrderAck(reply.data(), reply.size())))
+    {
+        cout << "Server Response: " << ack->header.status << " user " << ack->user_id << " now holds "
+             << formatMicros(ack->position_micros) << " " << string(ack->symbol, symbolLength(ack->symbol))
+             << ", USD balance $" << formatCents(ack->usd_cents);
+        if (ack->order_id)
+        {
+            cout << ", order " << ack->order_id;
+        }
+        cout << endl;
+    }
+    else if (type == MSG_BALANCE_REPLY && (balance = viewBalanceReply(reply.data(), reply.size())))
+    {
+        cout << "Server Response: " << balance->header.status << " balance for user " << balance->user_id
+             << ": $" << formatCents(balance->usd_cents) << endl;
+    }
+    else if (type == MSG_ERROR)
+    {
+        cout << "Server Response: " << header->status << " error" << endl;
+    }
+    else
+    {
+        cout << "Server Response: malformed binary reply (" << reply.size() << " bytes)" << endl;
+    }
+}
 
 int main(int argc, char *argv[])
 {
@@ -15,50 +333,116 @@ int main(int argc, char *argv[])
     struct sockaddr_in sin;
     char buf[MAX_LINE];
     string host;
-    int s, len;
+    bool useUnix = false;
+    bool useShm = false;
+    bool binary = false;
+    int s;
 
-    // Validate command-line arguments
-    if (argc == 2)
+    // Validate command-line arguments: a host, or --unix and a socket path,
+    // followed by optional flags
+    int arg = 1;
+    if (argc >= 3 && strcmp(argv[1], "--unix") == 0)
+    {
+        useUnix = true;
+        host = argv[2];
+        arg = 3;
+    }
+    else if (argc >= 2 && argv[1][0] != '-')
     {
         host = argv[1];
+        arg = 2;
     }
     else
     {
-        cerr << "Usage: simplex-talk <host>" << std::endl;
+        arg = -1;
+    }
+    for (; arg > 0 && arg < argc; arg++)
+    {
+        if (strcmp(argv[arg], "--binary") == 0)
+        {
+            binary = true;
+        }
+        else if (strcmp(argv[arg], "--shm") == 0 && useUnix)
+        {
+            useShm = true;
+        }
+        else
+        {
+            arg = -1;
+        }
+    }
+    if (arg < 0)
+    {
+        cerr << "Usage: simplex-talk <host> [--binary]\n"
+             << "       simplex-talk --unix <path> [--shm] [--binary]" << std::endl;
         return 1;
     }
 
-    // Translate host name into peer's IP address
-    hp = gethostbyname(host.c_str());
-    if (!hp)
+    if (useUnix)
     {
-        cerr << "simplex-talk: unknown host: " << host << std::endl;
-        return 1;
+        if ((s = connectUnix(host)) < 0)
+        {
+            return 1;
+        }
     }
+    else
+    {
+        // Translate host name into peer's IP address
+        hp = gethostbyname(host.c_str());
+        if (!hp)
+        {
+            cerr << "simplex-talk: unknown host: " << host << std::endl;
+            return 1;
+        }
+
+        // Build address data structure
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_family = AF_INET;
+        memcpy(&sin.sin_addr, hp->h_addr, hp->h_length);
+        sin.sin_port = htons(SERVER_PORT);
 
-    // Build address data structure
-    memset(&sin, 0, sizeof(sin));
-    sin.sin_family = AF_INET;
-    memcpy(&sin.sin_addr, hp->h_addr, hp->h_length);
-    sin.sin_port = htons(SERVER_PORT);
+        // Active open
+        if ((s = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+        {
+            perror("simplex-talk: socket");
+            return 1;
+        }
 
-    // Active open
-    if ((s = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+        if (connect(s, (struct sockaddr *)&sin, sizeof(sin)) < 0)
+        {
+            perror("simplex-talk: connect");
+            close(s);
+            return 1;
+        }
+    }
+
+    Link link;
+    link.s = s;
+    ShmChannel channel;
+    if (useShm && !requestSharedMemory(link, channel))
     {
-        perror("simplex-talk: socket");
+        cerr << "simplex-talk: server refused shared-memory transport" << endl;
+        close(s);
         return 1;
     }
 
-    if (connect(s, (struct sockaddr *)&sin, sizeof(sin)) < 0)
+    if (!negotiateFraming(link, binary))
     {
-        perror("simplex-talk: connect");
+        cerr << "simplex-talk: server refused " << (binary ? "binary" : "length-prefixed") << " framing" << endl;
         close(s);
         return 1;
     }
 
-    cout << "Connected to server at " << host << ":" << SERVER_PORT << endl;
+    if (useUnix)
+    {
+        cout << "Connected to server at " << host << (useShm ? " (shared memory)" : "") << endl;
+    }
+    else
+    {
+        cout << "Connected to server at " << host << ":" << SERVER_PORT << endl;
+    }
 
-    // Main loop: get and send lines of text, then receive the echo
+    // Main loop: get and send lines of text, then receive the response
     while (true)
     {
         cout << "Enter command: ";
@@ -68,16 +452,19 @@ int main(int argc, char *argv[])
         {
             break;
         }
+        if (buf[0] == '\0')
+        {
+            continue; // Nothing to send
+        }
 
         if (strcmp(buf, "QUIT") == 0)
         {
             cout << "200 OK" << endl;
             break;
         }
-        else if (strcmp(buf, "SHUTDOWN") == 0)
+        else if (strcmp(buf, "SHUTDOWN") == 0 && !binary)
         {
-            len = strlen(buf) + 1;
-            if (send(s, buf, len, 0) < 0)
+            if (!sendFrame(link, buf))
             {
                 perror("Send failed");
                 break;
@@ -86,53 +473,37 @@ int main(int argc, char *argv[])
             break;
         }
 
+        string message = buf;
+        if (binary)
+        {
+            string error;
+            if (!encodeBinaryCommand(buf, message, error))
+            {
+                cout << "Not sent: " << error << endl;
+                continue;
+            }
+        }
+
         // Send the command to the server
-        len = strlen(buf) + 1;
-        if (send(s, buf, len, 0) < 0)
+        if (!sendFrame(link, message))
         {
             perror("Send failed");
             break;
         }
 
-        // Handle the server's response
-        len = recv(s, buf, sizeof(buf), 0);
-        if (len > 0)
-        {
-            buf[len] = '\0'; // Null-terminate the received data
-
-            // If the server response is LIST
-            if (strcmp(buf, "The list of records in the Stocks database for user 1:") == 0)
-            {
-                cout << "Server Response: " << buf << endl;
-
-                // Now read the stock records from the server
-                while (true)
-                {
-                    len = recv(s, buf, sizeof(buf), 0);
-                    if (len > 0)
-                    {
-                        buf[len] = '\0'; // Null-terminate the received data
-                        if (strlen(buf) == 0)
-                            break; // No more records
-                        cout << "Stock Record: " << buf << endl;
-                    }
-                }
-            }
-            else
-            {
-                cout << "Server Response: " << buf << endl;
-            }
-        }
-        else if (len == 0)
+        // Each response is one frame, so long LIST output arrives whole
+        string response;
+        if (!recvFrame(link, response))
         {
             cout << "Server disconnected.\n";
             break;
         }
-        else
+        if (binary)
         {
-            perror("Receive failed");
-            break;
+            printBinaryReply(response);
+            continue;
         }
+        cout << "Server Response: " << response << endl;
     }
 
     // Close the socket
@@ -0,0 +1,492 @@
+#include <iostream>
+#include <cstring>
+#include <string>
+#include <sstream>
+#include <sqlite3.h>
+#include "account_cache.h"
+#include "commands.h"
+#include "database.h"
+#include "db_pool.h"
+#include "fixed_point.h"
+#include "symbol_table.h"
+#include "trade.h"
+#include "protocol.h"
+
+// Turns the amount and price tokens of a BUY/SELL into micro-shares and
+// cents. The text is parsed as an exact decimal, never via a double, so
+// "0.1" is exactly 100000 micro-shares. Returns an error reply, or "" if OK.
+static std::string parseTradeValues(const char *command,
+                                    const std::string &input,
+                                    const std::string &amountText,
+                                    const std::string &priceText,
+                                    int64_t &amount_micros,
+                                    int64_t &price_cents)
+{
+    if (!parseMicros(amountText, amount_micros) || !parseCents(priceText, price_cents))
+    {
+        std::cerr << "Invalid " << command << " amount or price: " << input << std::endl;
+        return std::string("400 Bad Request: ") + command +
+               " amounts take up to 6 decimals and prices up to 2\n";
+    }
+
+    // Negative values are checked by the caller; this only catches trades
+    // whose cash value cannot be represented
+    int64_t value_cents;
+    if (amount_micros >= 0 && price_cents >= 0 && !tradeValueCents(amount_micros, price_cents, value_cents, Rounding::Up))
+    {
+        std::cerr << "Invalid " << command << ": trade value out of range (" << input << ")" << std::endl;
+        return std::string("400 Bad Request: ") + command + " value out of range\n";
+    }
+    return "";
+}
+
+// Rejects unlisted symbols before anything else runs
+static std::string unknownSymbol(const char *command, const std::string &symbol)
+{
+    std::cerr << "Rejected " << command << ": symbol " << symbol << " is not listed" << std::endl;
+    return "404 Not Found\nSymbol " + symbol + " is not listed.\n";
+}
+
+static std::string handleBuy(std::istringstream &iss, const std::string &input, CommandContext &ctx)
+{
+    std::string stock_symbol, amount_text, price_text;
+    int64_t stock_amount, price_per_stock;
+    int user_id;
+
+    // Extract required parameters
+    if (!(iss >> stock_symbol >> amount_text >> price_text >> user_id))
+    {
+        std::cerr << "Invalid BUY command format received: " << input << std::endl;
+        return "400 Bad Request: Invalid BUY format\n";
+    }
+    uint32_t symbol_id = ctx.symbols.find(stock_symbol);
+    if (symbol_id == SYMBOL_NONE)
+    {
+        return unknownSymbol("BUY", stock_symbol);
+    }
+    std::string error = parseTradeValues("BUY", input, amount_text, price_text, stock_amount, price_per_stock);
+    if (!error.empty())
+    {
+        return error;
+    }
+
+    // Check for negative numbers in the BUY command parameters.
+    // If any negative value is provided, reject the command.
+    if (stock_amount < 0 || price_per_stock < 0 || user_id < 0)
+    {
+        std::cerr << "Invalid BUY command: Negative values are not allowed (" << input << ")" << std::endl;
+        return "400 Bad Request: Negative values are not permitted in BUY command\n";
+    }
+
+    // Log received command
+    std::cout << "s: Received: BUY " << stock_symbol << " " << formatMicros(stock_amount)
+              << " " << formatCents(price_per_stock) << " " << user_id << std::endl;
+
+    // Attempt to process the stock purchase; returns once it is committed
+    Trade trade{true, stock_symbol, symbol_id, stock_amount, price_per_stock, user_id};
+    if (!ctx.trades.execute(trade))
+    {
+        return "400 Bad Request: Transaction failed\n";
+    }
+
+    std::ostringstream response;
+    if (trade.order_id != 0)
+    {
+        response << "200 OK\nBUY ORDER " << trade.order_id << ": Filled " << formatMicros(trade.filled_micros)
+                 << ", resting " << formatMicros(trade.resting_micros) << ". New balance: "
+                 << formatMicros(trade.position_micros) << " " << stock_symbol
+                 << ". USD balance $" << formatCents(trade.usd_cents) << "\n";
+        return response.str();
+    }
+    response << "200 OK\nBOUGHT: New balance: " << formatMicros(trade.position_micros)
+             << " " << stock_symbol << ". USD balance $" << formatCents(trade.usd_cents) << "\n";
+    return response.str();
+}
+
+static std::string handleSell(std::istringstream &iss, const std::string &input, CommandContext &ctx)
+{
+    std::string stock_symbol, amount_text, price_text;
+    int64_t stock_amount, price_per_stock;
+    int user_id;
+
+    // Extract required parameters
+    if (!(iss >> stock_symbol >> amount_text >> price_text >> user_id))
+    {
+        std::cerr << "Invalid SELL command format received: " << input << std::endl;
+        return "400 Bad Request: Invalid SELL format\n";
+    }
+    uint32_t symbol_id = ctx.symbols.find(stock_symbol);
+    if (symbol_id == SYMBOL_NONE)
+    {
+        return unknownSymbol("SELL", stock_symbol);
+    }
+    std::string error = parseTradeValues("SELL", input, amount_text, price_text, stock_amount, price_per_stock);
+    if (!error.empty())
+    {
+        return error;
+    }
+
+    // Check for negative numbers in the SELL command parameters.
+    if (stock_amount < 0 || price_per_stock < 0 || user_id < 0)
+    {
+        std::cerr << "Invalid SELL command: Negative values are not allowed (" << input << ")" << std::endl;
+        return "400 Bad Request: Negative values are not permitted in SELL command\n";
+    }
+
+    // Log received command
+    std::cout << "s: Received: SELL " << stock_symbol << " " << formatMicros(stock_amount)
+              << " " << formatCents(price_per_stock) << " " << user_id << std::endl;
+
+    // Attempt to process the stock sale; returns once it is committed
+    Trade trade{false, stock_symbol, symbol_id, stock_amount, price_per_stock, user_id};
+    if (!ctx.trades.execute(trade))
+    {
+        return "400 Bad Request: Transaction failed\n";
+    }
+
+    std::ostringstream response;
+    if (trade.order_id != 0)
+    {
+        response << "200 OK\nSELL ORDER " << trade.order_id << ": Filled " << formatMicros(trade.filled_micros)
+                 << ", resting " << formatMicros(trade.resting_micros) << ". New balance: "
+                 << formatMicros(trade.position_micros) << " " << stock_symbol
+                 << ". USD $" << formatCents(trade.usd_cents) << "\n";
+        return response.str();
+    }
+    response << "200 OK\nSOLD: New balance: " << formatMicros(trade.position_micros)
+             << " " << stock_symbol << ". USD $" << formatCents(trade.usd_cents) << "\n";
+    return response.str();
+}
+
+static std::string handleCancel(std::istringstream &iss, const std::string &input, CommandContext &ctx)
+{
+    std::string stock_symbol;
+    int64_t order_id;
+    int user_id;
+
+    if (!(iss >> stock_symbol >> order_id >> user_id))
+    {
+        std::cerr << "Invalid CANCEL command format received: " << input << std::endl;
+        return "400 Bad Request: Invalid CANCEL format\n";
+    }
+    uint32_t symbol_id = ctx.symbols.find(stock_symbol);
+    if (symbol_id == SYMBOL_NONE)
+    {
+        return unknownSymbol("CANCEL", stock_symbol);
+    }
+    if (order_id <= 0 || user_id < 0)
+    {
+        std::cerr << "Invalid CANCEL command: Negative values are not allowed (" << input << ")" << std::endl;
+        return "400 Bad Request: Negative values are not permitted in CANCEL command\n";
+    }
+
+    std::cout << "s: Received: CANCEL " << stock_symbol << " " << order_id << " " << user_id << std::endl;
+
+    // Runs on the symbol's engine thread in sequence with its trades
+    Trade trade{false, stock_symbol, symbol_id, 0, 0, user_id};
+    trade.action = OrderAction::Cancel;
+    trade.target_id = (uint64_t)order_id;
+    if (!ctx.trades.execute(trade))
+    {
+        return "400 Bad Request: Cancel failed\n";
+    }
+
+    std::ostringstream response;
+    response << "200 OK\nCANCELLED " << (trade.buy ? "BUY" : "SELL") << " ORDER " << trade.order_id
+             << ". USD balance $" << formatCents(trade.usd_cents) << "\n";
+    return response.str();
+}
+
+static std::string handleReplace(std::istringstream &iss, const std::string &input, CommandContext &ctx)
+{
+    std::string stock_symbol, amount_text, price_text;
+    int64_t order_id, stock_amount, price_per_stock;
+    int user_id;
+
+    if (!(iss >> stock_symbol >> order_id >> amount_text >> price_text >> user_id))
+    {
+        std::cerr << "Invalid REPLACE command format received: " << input << std::endl;
+        return "400 Bad Request: Invalid REPLACE format\n";
+    }
+    uint32_t symbol_id = ctx.symbols.find(stock_symbol);
+    if (symbol_id == SYMBOL_NONE)
+    {
+        return unknownSymbol("REPLACE", stock_symbol);
+    }
+    std::string error = parseTradeValues("REPLACE", input, amount_text, price_text, stock_amount, price_per_stock);
+    if (!error.empty())
+    {
+        return error;
+    }
+
+    // A replace to nothing is a CANCEL
+    if (order_id <= 0 || stock_amount <= 0 || price_per_stock < 0 || user_id < 0)
+    {
+        std::cerr << "Invalid REPLACE command: values out of range (" << input << ")" << std::endl;
+        return "400 Bad Request: REPLACE needs a positive amount and no negative values\n";
+    }
+
+    std::cout << "s: Received: REPLACE " << stock_symbol << " " << order_id << " " << formatMicros(stock_amount)
+              << " " << formatCents(price_per_stock) << " " << user_id << std::endl;
+
+    Trade trade{false, stock_symbol, symbol_id, stock_amount, price_per_stock, user_id};
+    trade.action = OrderAction::Replace;
+    trade.target_id = (uint64_t)order_id;
+    if (!ctx.trades.execute(trade))
+    {
+        return "400 Bad Request: Replace failed\n";
+    }
+
+    // Same ID: the order kept its place. Otherwise it was cancelled and
+    // the new order may already have traded.
+    std::ostringstream response;
+    response << "200 OK\nREPLACED " << (trade.buy ? "BUY" : "SELL") << " ORDER " << trade.target_id
+             << " WITH ORDER " << trade.order_id << ": Filled " << formatMicros(trade.filled_micros)
+             << ", resting " << formatMicros(trade.resting_micros) << ". New balance: "
+             << formatMicros(trade.position_micros) << " " << stock_symbol
+             << ". USD balance $" << formatCents(trade.usd_cents) << "\n";
+    return response.str();
+}
+
+static std::string handleList(CommandContext &ctx)
+{
+    // Log received command
+    std::cout << "s: Received: LIST" << std::endl;
+
+    // Prepare the response
+    std::ostringstream response;
+
+    // Borrow a read connection and declare the statement pointer. The pool
+    // owns it, so error paths just return and let the lease hand it back.
+    DbLease lease(ctx.db, DbRole::Reader);
+    if (!lease.ok())
+    {
+        return "400 Bad Request: Unable to open database\n";
+    }
+    DbConnection &conn = lease.connection();
+    sqlite3 *db = conn.db;
+    sqlite3_stmt *stmt;
+
+    const char *schemaQuery = "SELECT name FROM sqlite_master WHERE type='table' AND name='Stocks';";
+
+    // Prepare the schema query to check if 'Stocks' table exists
+    int schemaRc = conn.statements.prepare(db, schemaQuery, &stmt);
+    if (schemaRc != SQLITE_OK)
+    {
+        std::cerr << "Failed to prepare schema query: " << sqlite3_errmsg(db) << std::endl;
+        return "400 Bad Request: Unable to list stocks\n";
+    }
+
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        std::cout << "Stocks table exists." << std::endl;
+    }
+    else
+    {
+        std::cout << "Stocks table does not exist." << std::endl;
+        sqlite3_reset(stmt);
+        return "400 Bad Request: Unable to list stocks\n";
+    }
+    sqlite3_reset(stmt); // Done with the schema check statement
+
+    const char *query = "SELECT ID, stock_symbol, stock_name, stock_balance_micros, user_id FROM Stocks;";
+
+    // Prepare the SELECT statement to get stocks
+    int rc = conn.statements.prepare(db, query, &stmt);
+    if (rc != SQLITE_OK)
+    {
+        std::cerr << "Failed to prepare SELECT statement: " << sqlite3_errmsg(db) << std::endl;
+        return "400 Bad Request: Unable to list stocks\n";
+    }
+
+    // Start building the response
+    response << "200 OK\nThe list of stocks:\n";
+
+    // Iterate over the query results
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        int stock_id = sqlite3_column_int(stmt, 0);
+        const char *stock_symbol = (const char *)sqlite3_column_text(stmt, 1);
+        const char *stock_name = (const char *)sqlite3_column_text(stmt, 2);
+        int64_t stock_balance = sqlite3_column_int64(stmt, 3);
+        int user_id = sqlite3_column_int(stmt, 4);
+
+        // Append the data to the response
+        response << stock_id << " " << stock_symbol << " " << stock_name << " " << formatMicros(stock_balance) << " " << user_id << "\n";
+    }
+
+    sqlite3_reset(stmt); // Done with the SELECT statement
+
+    return response.str();
+}
+
+static std::string handleBalance(CommandContext &ctx)
+{
+    std::cout << "s: Received: BALANCE" << std::endl;
+
+    int user_id = 1; // Always show balance for user 1
+    std::string first_name, last_name;
+    int64_t usd_cents;
+
+    if (!ctx.accounts.user(user_id, first_name, last_name, usd_cents))
+    {
+        std::string errorMsg = "404 Not Found\nUser with ID " + std::to_string(user_id) + " does not exist.\n";
+        std::cout << "Sending error response: " << errorMsg; // Debug log
+        return errorMsg;
+    }
+
+    std::ostringstream response;
+    response << "200 OK\n"
+             << "Balance for user " << first_name << " " << last_name
+             << ": $" << formatCents(usd_cents) << "\n";
+    std::string responseStr = response.str();
+
+    std::cout << "Sending response: " << responseStr; // Debug log
+    return responseStr;
+}
+
+// Persistence mode and counters, and the account cache
+static std::string handleStats(CommandContext &ctx)
+{
+    std::cout << "s: Received: STATS" << std::endl;
+
+    std::ostringstream response;
+    response << "200 OK\n";
+    ctx.trades.report(response);
+    response << "Account cache: " << ctx.accounts.users() << " user(s), " << ctx.accounts.positions()
+             << " position(s), " << ctx.accounts.hits() << " hit(s), " << ctx.accounts.misses() << " miss(es)\n";
+    return response.str();
+}
+
+std::string handleCommand(const std::string &input,
+                          CommandContext &ctx,
+                          bool &shutdownRequested)
+{
+    // Parse the command
+    std::istringstream iss(input);
+    std::string command;
+    iss >> command;
+
+    if (command == "BUY")
+    {
+        return handleBuy(iss, input, ctx);
+    }
+    else if (command == "SELL")
+    {
+        return handleSell(iss, input, ctx);
+    }
+    else if (command == "CANCEL")
+    {
+        return handleCancel(iss, input, ctx);
+    }
+    else if (command == "REPLACE")
+    {
+        return handleReplace(iss, input, ctx);
+    }
+    else if (command == "LIST")
+    {
+        return handleList(ctx);
+    }
+    else if (command == "BALANCE")
+    {
+        return handleBalance(ctx);
+    }
+    else if (command == "STATS")
+    {
+        return handleStats(ctx);
+    }
+    else if (command == "SHUTDOWN")
+    {
+        std::cout << "Received: SHUTDOWN" << std::endl;
+        shutdownRequested = true;
+        return "";
+    }
+
+    return "400 Bad Request: Invalid Command\n";
+}
+
+bool isShutdownCommand(const std::string &input)
+{
+    std::istringstream iss(input);
+    std::string command;
+    iss >> command;
+    return command == "SHUTDOWN";
+}
+
+// Binary BUY/SELL. Same checks as the text commands, but the fields are
+// read straight out of the received frame, so nothing is parsed.
+static std::string handleBinaryOrder(const OrderRequest &order, CommandContext &ctx)
+{
+    OrderAck ack{};
+    ack.user_id = order.user_id;
+    memcpy(ack.symbol, order.symbol, SYMBOL_LEN);
+
+    bool buy = order.header.type == MSG_BUY;
+    size_t symbolLen = symbolLength(order.symbol);
+    int64_t value_cents;
+    if (symbolLen == 0 || order.user_id < 0 ||
+        !tradeValueCents(order.quantity_micros, order.price_cents, value_cents, Rounding::Up))
+    {
+        std::cerr << "Invalid binary " << (buy ? "BUY" : "SELL") << " for user " << order.user_id << std::endl;
+        return encodeOrderAck(STATUS_BAD_REQUEST, ack);
+    }
+
+    std::string symbol(order.symbol, symbolLen);
+    uint32_t symbol_id = ctx.symbols.find(symbol);
+    if (symbol_id == SYMBOL_NONE)
+    {
+        unknownSymbol(buy ? "BUY" : "SELL", symbol);
+        return encodeOrderAck(STATUS_NOT_FOUND, ack);
+    }
+
+    Trade trade{buy, symbol, symbol_id, order.quantity_micros, order.price_cents, order.user_id};
+    if (!ctx.trades.execute(trade))
+    {
+        return encodeOrderAck(STATUS_BAD_REQUEST, ack);
+    }
+
+    ack.usd_cents = trade.usd_cents;
+    ack.position_micros = trade.position_micros;
+    ack.order_id = trade.order_id;
+    return encodeOrderAck(STATUS_OK, ack);
+}
+
+static std::string handleBinaryBalance(const BalanceRequest &request, CommandContext &ctx)
+{
+    BalanceReply reply{};
+    reply.user_id = request.user_id;
+
+    int64_t usd_cents = 0;
+    if (!ctx.accounts.cash(request.user_id, usd_cents))
+    {
+        return encodeBalanceReply(STATUS_NOT_FOUND, reply);
+    }
+    reply.usd_cents = usd_cents;
+    return encodeBalanceReply(STATUS_OK, reply);
+}
+
+std::string handleBinaryCommand(const std::string &frame, CommandContext &ctx)
+{
+    const MsgHeader *header = viewHeader(frame.data(), frame.size());
+    if (!header)
+    {
+        return encodeErrorReply(STATUS_BAD_REQUEST);
+    }
+
+    if (header->type == MSG_BUY || header->type == MSG_SELL)
+    {
+        if (const OrderRequest *order = viewOrderRequest(frame.data(), frame.size()))
+        {
+            return handleBinaryOrder(*order, ctx);
+        }
+    }
+    else if (header->type == MSG_BALANCE)
+    {
+        if (const BalanceRequest *request = viewBalanceRequest(frame.data(), frame.size()))
+        {
+            return handleBinaryBalance(*request, ctx);
+        }
+    }
+
+    return encodeErrorReply(STATUS_BAD_REQUEST);
+}
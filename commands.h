@@ -0,0 +1,38 @@
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#include <string>
+
+class DbPool;
+class TradeExecutor;
+class AccountCache;
+class SymbolTable;
+
+// What commands run against, shared by every worker thread. Balances are
+// read from accounts, reports borrow a connection from db, trades go
+// through trades, and only symbols listed in symbols can be traded.
+struct CommandContext
+{
+    DbPool &db;
+    TradeExecutor &trades;
+    AccountCache &accounts;
+    const SymbolTable &symbols;
+};
+
+// Parses one text command (BUY, SELL, CANCEL, REPLACE, LIST, BALANCE, STATS,
+// SHUTDOWN) and runs it
+// against the database. Returns the full response to send back to the client.
+// SHUTDOWN sets shutdownRequested and returns an empty response.
+std::string handleCommand(const std::string &input,
+                          CommandContext &ctx,
+                          bool &shutdownRequested);
+
+// True if handleCommand would treat this line as SHUTDOWN: its first
+// word is parsed the same way, so trailing spaces or a CR still match
+bool isShutdownCommand(const std::string &input);
+
+// Runs one binary message (see protocol.h) and returns the encoded reply.
+// Only BUY, SELL and BALANCE exist in the binary protocol.
+std::string handleBinaryCommand(const std::string &frame, CommandContext &ctx);
+
+#endif
@@ -2,30 +2,205 @@
 #define DATABASE_H
 
 #include <sqlite3.h>
+#include <fstream>
+#include <sstream>
 #include <string>
+#include "account_cache.h"
 #include "database.h"
+#include "db_pool.h"
+#include "db_profile.h"
+#include "fixed_point.h"
+#include "symbol_table.h"
+#include "trade.h"
 #include <iostream>
 
-bool openDatabase(sqlite3 **db, const std::string &dbName)
+bool openDatabase(sqlite3 **db, const std::string &dbName, bool readOnly)
 {
-    std::cout << "Opening database at path: " << dbName << std::endl;
-    int rc = sqlite3_open(dbName.c_str(), db);
+    std::cout << "Opening database at path: " << dbName << (readOnly ? " (read-only)" : "") << std::endl;
+    // Each handle is only ever used by one thread at a time (see DbPool), so
+    // SQLite's own per-connection mutex is not needed
+    int flags = (readOnly ? SQLITE_OPEN_READONLY : SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE) | SQLITE_OPEN_NOMUTEX;
+    int rc = sqlite3_open_v2(dbName.c_str(), db, flags, nullptr);
     if (rc != SQLITE_OK)
     {
         std::cerr << "Error opening database: " << sqlite3_errmsg(*db) << std::endl;
         return false;
     }
+    // Readers and the writer hold separate connections; wait out each other's locks instead of failing
+    sqlite3_busy_timeout(*db, 5000);
     std::cout << "Database '" << dbName << "' opened successfully.\n";
     return true;
 }
-bool initializeDatabase(const std::string &dbName)
+// Returns whether table has a column called column
+static bool hasColumn(sqlite3 *db, const char *table, const char *column)
+{
+    sqlite3_stmt *stmt;
+    const char *query = "SELECT COUNT(*) FROM pragma_table_info(?) WHERE name = ?;";
+    if (sqlite3_prepare_v2(db, query, -1, &stmt, nullptr) != SQLITE_OK)
+    {
+        return false;
+    }
+    sqlite3_bind_text(stmt, 1, table, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, column, -1, SQLITE_STATIC);
+    bool found = sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int(stmt, 0) > 0;
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+// Databases written before balances were fixed-point hold them as DOUBLE
+// usd_balance / stock_balance. SQLite cannot change a column's type, so both
+// tables are rebuilt with integer cents and micro-shares, rounding each
+// value once, in a single transaction. user_version records the result.
+static bool migrateFixedPoint(sqlite3 *db)
+{
+    if (!hasColumn(db, "Users", "usd_balance"))
+    {
+        return true;
+    }
+
+    std::cout << "Converting balances to fixed-point cents and micro-shares..." << std::endl;
+    const char *migrateSQL = R"(
+        BEGIN IMMEDIATE;
+        CREATE TABLE Users_fixed (
+            ID INTEGER PRIMARY KEY AUTOINCREMENT,
+            first_name TEXT,
+            last_name TEXT,
+            user_name TEXT NOT NULL UNIQUE,
+            password TEXT,
+            usd_balance_cents INTEGER NOT NULL);
+        INSERT INTO Users_fixed (ID, first_name, last_name, user_name, password, usd_balance_cents)
+            SELECT ID, first_name, last_name, user_name, password, CAST(ROUND(usd_balance * 100) AS INTEGER) FROM Users;
+        CREATE TABLE Stocks_fixed (
+            ID INTEGER PRIMARY KEY AUTOINCREMENT,
+            stock_symbol TEXT NOT NULL,
+            stock_name TEXT NOT NULL,
+            stock_balance_micros INTEGER NOT NULL,
+            user_id INTEGER,
+            FOREIGN KEY (user_id) REFERENCES Users(ID) ON DELETE CASCADE);
+        INSERT INTO Stocks_fixed (ID, stock_symbol, stock_name, stock_balance_micros, user_id)
+            SELECT ID, stock_symbol, stock_name, CAST(ROUND(IFNULL(stock_balance, 0) * 1000000) AS INTEGER), user_id FROM Stocks;
+        DROP TABLE Stocks;
+        DROP TABLE Users;
+        ALTER TABLE Users_fixed RENAME TO Users;
+        ALTER TABLE Stocks_fixed RENAME TO Stocks;
+        PRAGMA user_version = 1;
+        COMMIT;
+    )";
+
+    char *errMsg = nullptr;
+    if (sqlite3_exec(db, migrateSQL, nullptr, nullptr, &errMsg) != SQLITE_OK)
+    {
+        std::cerr << "Error converting balances: " << errMsg << std::endl;
+        sqlite3_free(errMsg);
+        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        return false;
+    }
+    return true;
+}
+
+// Creates the unique (user_id, stock_symbol) index. Older versions could
+// leave several rows for one position, so those are merged into the oldest
+// row first; the whole migration is one transaction.
+static bool migratePositionIndex(sqlite3 *db)
+{
+    sqlite3_stmt *stmt;
+    const char *indexExists = "SELECT COUNT(*) FROM sqlite_master WHERE type = 'index' AND name = 'idx_stocks_user_symbol';";
+    if (sqlite3_prepare_v2(db, indexExists, -1, &stmt, nullptr) != SQLITE_OK)
+    {
+        std::cerr << "Failed to check for the position index: " << sqlite3_errmsg(db) << std::endl;
+        return false;
+    }
+    bool exists = sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int(stmt, 0) > 0;
+    sqlite3_finalize(stmt);
+    if (exists)
+    {
+        return true;
+    }
+
+    const char *migrateSQL = R"(
+        BEGIN IMMEDIATE;
+        UPDATE Stocks SET stock_balance_micros = (
+            SELECT SUM(dup.stock_balance_micros) FROM Stocks dup
+            WHERE dup.user_id = Stocks.user_id AND dup.stock_symbol = Stocks.stock_symbol)
+        WHERE ID IN (SELECT MIN(ID) FROM Stocks GROUP BY user_id, stock_symbol HAVING COUNT(*) > 1);
+        DELETE FROM Stocks WHERE ID NOT IN (SELECT MIN(ID) FROM Stocks GROUP BY user_id, stock_symbol);
+        CREATE UNIQUE INDEX idx_stocks_user_symbol ON Stocks (user_id, stock_symbol);
+        COMMIT;
+    )";
+
+    char *errMsg = nullptr;
+    if (sqlite3_exec(db, migrateSQL, nullptr, nullptr, &errMsg) != SQLITE_OK)
+    {
+        std::cerr << "Error creating position index: " << errMsg << std::endl;
+        sqlite3_free(errMsg);
+        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        return false;
+    }
+
+    std::cout << "Created unique index on Stocks (user_id, stock_symbol)." << std::endl;
+    return true;
+}
+
+// Creates the Symbols table, the symbol master that trades are checked
+// against, and lists every symbol someone already holds so existing
+// positions stay tradable
+static bool migrateSymbols(sqlite3 *db)
+{
+    sqlite3_stmt *stmt;
+    const char *tableExists = "SELECT COUNT(*) FROM sqlite_master WHERE type = 'table' AND name = 'Symbols';";
+    if (sqlite3_prepare_v2(db, tableExists, -1, &stmt, nullptr) != SQLITE_OK)
+    {
+        std::cerr << "Failed to check for the Symbols table: " << sqlite3_errmsg(db) << std::endl;
+        return false;
+    }
+    bool exists = sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int(stmt, 0) > 0;
+    sqlite3_finalize(stmt);
+    if (exists)
+    {
+        return true;
+    }
+
+    const char *migrateSQL = R"(
+        BEGIN IMMEDIATE;
+        CREATE TABLE Symbols (
+            ID INTEGER PRIMARY KEY AUTOINCREMENT,
+            symbol TEXT NOT NULL UNIQUE,
+            name TEXT NOT NULL
+        );
+        INSERT INTO Symbols (symbol, name)
+            SELECT stock_symbol, MIN(stock_name) FROM Stocks GROUP BY stock_symbol ORDER BY MIN(ID);
+        COMMIT;
+    )";
+
+    char *errMsg = nullptr;
+    if (sqlite3_exec(db, migrateSQL, nullptr, nullptr, &errMsg) != SQLITE_OK)
+    {
+        std::cerr << "Error creating Symbols table: " << errMsg << std::endl;
+        sqlite3_free(errMsg);
+        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        return false;
+    }
+
+    std::cout << "Created Symbols table from " << sqlite3_changes(db) << " held symbol(s)." << std::endl;
+    return true;
+}
+
+bool initializeDatabase(const std::string &dbName, const DbProfile &profile)
 {
     sqlite3 *db = nullptr;
-    if (!openDatabase(&db, dbName))
+    if (!openDatabase(&db, dbName, false))
     {
         return false;
     }
 
+    // Journal mode and page size belong to the file, so they are set here,
+    // before the pool opens its connections and before any table exists
+    if (!applyDbFileSettings(db, profile))
+    {
+        sqlite3_close(db);
+        return false;
+    }
+
     char *errMsg = nullptr;
     sqlite3_stmt *stmt;
 
@@ -36,7 +211,7 @@ bool initializeDatabase(const std::string &dbName)
         "last_name TEXT, "
         "user_name TEXT NOT NULL UNIQUE, "
         "password TEXT, "
-        "usd_balance DOUBLE NOT NULL"
+        "usd_balance_cents INTEGER NOT NULL"
         ");";
 
     const char *createStocksTable =
@@ -44,7 +219,7 @@ bool initializeDatabase(const std::string &dbName)
         "ID INTEGER PRIMARY KEY AUTOINCREMENT, "
         "stock_symbol TEXT NOT NULL, "
         "stock_name TEXT NOT NULL, "
-        "stock_balance DOUBLE, "
+        "stock_balance_micros INTEGER NOT NULL, "
         "user_id INTEGER, "
         "FOREIGN KEY (user_id) REFERENCES Users(ID) ON DELETE CASCADE"
         ");";
@@ -69,6 +244,29 @@ bool initializeDatabase(const std::string &dbName)
         return false;
     }
 
+    // Bring an existing file up to date: integer balances first, then the
+    // position index, which is built on the rebuilt table
+    if (!migrateFixedPoint(db))
+    {
+        sqlite3_close(db);
+        return false;
+    }
+
+    // Positions are looked up by (user, symbol); make that an index and
+    // guarantee one row per pair
+    if (!migratePositionIndex(db))
+    {
+        sqlite3_close(db);
+        return false;
+    }
+
+    // Only listed symbols can be traded
+    if (!migrateSymbols(db))
+    {
+        sqlite3_close(db);
+        return false;
+    }
+
     // Check if there is at least one user
     const char *checkUserSQL = "SELECT COUNT(*) FROM Users;";
     rc = sqlite3_prepare_v2(db, checkUserSQL, -1, &stmt, nullptr);
@@ -85,8 +283,8 @@ bool initializeDatabase(const std::string &dbName)
         {
             std::cout << "No users found. Creating default user..." << std::endl;
             const char *insertDefaultUser = R"(
-                INSERT INTO Users (first_name, last_name, user_name, password, usd_balance)
-                VALUES ('John', 'Doe', 'admin', 'password', 100.00);
+                INSERT INTO Users (first_name, last_name, user_name, password, usd_balance_cents)
+                VALUES ('John', 'Doe', 'admin', 'password', 10000);
             )";
 
             rc = sqlite3_exec(db, insertDefaultUser, nullptr, nullptr, &errMsg);
@@ -116,375 +314,321 @@ bool initializeDatabase(const std::string &dbName)
     return true;
 }
 
-bool buyStock(const std::string &stock_symbol,
-              const std::string &stock_name,
-              double amount,
-              double price_per_stock,
-              int user_id,
-              const std::string &dbName)
+bool importSymbols(sqlite3 *db, const std::string &path)
 {
-    sqlite3 *db;
-    int rc;
-    sqlite3_stmt *stmt;
-
-    if (!openDatabase(&db, dbName))
+    std::ifstream file(path);
+    if (!file)
     {
+        std::cerr << "Failed to open symbol list " << path << std::endl;
         return false;
     }
-    // Query to check if the user exists
-    const char *userExists = "SELECT COUNT(*) FROM Users WHERE ID = ?;";
 
-    // Prepare the SQL statement
-    rc = sqlite3_prepare_v2(db, userExists, -1, &stmt, nullptr);
-    if (rc != SQLITE_OK)
+    sqlite3_stmt *stmt;
+    const char *upsertSymbol = R"(
+        INSERT INTO Symbols (symbol, name) VALUES (?, ?)
+        ON CONFLICT (symbol) DO UPDATE SET name = excluded.name;
+    )";
+    if (sqlite3_prepare_v2(db, upsertSymbol, -1, &stmt, nullptr) != SQLITE_OK)
     {
-        std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db) << std::endl;
-        sqlite3_close(db);
+        std::cerr << "Failed to prepare symbol import: " << sqlite3_errmsg(db) << std::endl;
         return false;
     }
 
-    // Bind user_id to the query
-    sqlite3_bind_int(stmt, 1, user_id);
-
-    // Execute statement and check if user exists
-    bool userExistsFlag = false;
-    if (sqlite3_step(stmt) == SQLITE_ROW)
+    bool ok = sqlite3_exec(db, "BEGIN IMMEDIATE;", nullptr, nullptr, nullptr) == SQLITE_OK;
+    std::string line;
+    size_t count = 0;
+    while (ok && std::getline(file, line))
     {
-        userExistsFlag = sqlite3_column_int(stmt, 0) > 0; // Get the COUNT(*) value
-    }
+        std::istringstream fields(line.substr(0, line.find('#')));
+        std::string symbol, name;
+        if (!(fields >> symbol))
+        {
+            continue; // Blank or comment
+        }
+        std::getline(fields >> std::ws, name);
+        if (name.empty())
+        {
+            name = symbol;
+        }
 
-    // Finalize statement
+        sqlite3_bind_text(stmt, 1, symbol.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(stmt, 2, name.c_str(), -1, SQLITE_TRANSIENT);
+        ok = sqlite3_step(stmt) == SQLITE_DONE;
+        sqlite3_reset(stmt);
+        count++;
+    }
     sqlite3_finalize(stmt);
-
-    if (!userExistsFlag)
+    if (!ok || sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr) != SQLITE_OK)
     {
-        std::cerr << "User ID " << user_id << " does not exist!" << std::endl;
-        sqlite3_close(db);
+        std::cerr << "Failed to import symbols from " << path << ": " << sqlite3_errmsg(db) << std::endl;
+        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
         return false;
     }
+    std::cout << "Listed " << count << " symbol(s) from " << path << std::endl;
+    return true;
+}
 
-    // Query to check for stock
-    const char *stockExists = "SELECT COUNT(*) FROM Stocks WHERE stock_symbol = ? AND user_id = ?;";
-
-    // Prepare statement
-    rc = sqlite3_prepare_v2(db, stockExists, -1, &stmt, nullptr);
-    if (rc != SQLITE_OK)
+bool loadSymbols(sqlite3 *db, SymbolTable &symbols)
+{
+    sqlite3_stmt *stmt;
+    const char *symbolsSQL = "SELECT symbol, name FROM Symbols ORDER BY ID;";
+    if (sqlite3_prepare_v2(db, symbolsSQL, -1, &stmt, nullptr) != SQLITE_OK)
     {
-        std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db) << std::endl;
-        sqlite3_close(db);
+        std::cerr << "Failed to prepare symbol load: " << sqlite3_errmsg(db) << std::endl;
         return false;
     }
-
-    // Bind two values to query
-    sqlite3_bind_text(stmt, 1, stock_symbol.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_int(stmt, 2, user_id);
-
-    // Execute the query
-    rc = sqlite3_step(stmt);
-
-    // Check if stock exists
-    bool stockExistsFlag = false;
-    int stockCount = 0;
-
-    if (sqlite3_step(stmt) == SQLITE_ROW)
+    while (sqlite3_step(stmt) == SQLITE_ROW)
     {
-        stockCount = sqlite3_column_int(stmt, 0);
+        const char *symbol = (const char *)sqlite3_column_text(stmt, 0);
+        const char *name = (const char *)sqlite3_column_text(stmt, 1);
+        if (symbol && *symbol)
+        {
+            symbols.add(symbol, name ? name : "");
+        }
     }
-
-    stockExistsFlag = stockCount > 0;
-
     sqlite3_finalize(stmt);
 
-    // If the stock does not exist then we insert a new one
-    if (stockExistsFlag == false)
+    std::cout << "Symbol master: " << symbols.size() << " symbol(s) listed" << std::endl;
+    if (symbols.size() == 0)
     {
-        // Query to insert new stock
-        const char *stockInsert = R"(
-            INSERT INTO Stocks (stock_symbol, stock_name, stock_balance, user_id)
-            VALUES (?, ?, ?, ?);
-        )";
-
-        // Prepare statement
-        rc = sqlite3_prepare_v2(db, stockInsert, -1, &stmt, nullptr);
-        if (rc != SQLITE_OK)
-        {
-            std::cerr << "Failed to prepare INSERT statement: " << sqlite3_errmsg(db) << std::endl;
-            sqlite3_close(db);
-            return false;
-        }
-
-        sqlite3_bind_text(stmt, 1, stock_symbol.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_text(stmt, 2, stock_name.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_double(stmt, 3, amount);
-        sqlite3_bind_int(stmt, 4, user_id);
-
-        // Execute the INSERT statement
-        rc = sqlite3_step(stmt);
-        if (rc != SQLITE_DONE)
-        {
-            std::cerr << "Error inserting new stock: " << sqlite3_errmsg(db) << std::endl;
-        }
-        else
-        {
-            std::cout << "New stock record inserted successfully!" << std::endl;
-        }
-
-        sqlite3_finalize(stmt);
+        std::cerr << "No symbols are listed, so every BUY and SELL will be rejected; see --symbols" << std::endl;
     }
+    return true;
+}
 
-    double total_cost = amount * price_per_stock;
-
-    // Query to check user balance
-    const char *userBalance = "SELECT usd_balance FROM Users WHERE ID = ?;";
-
-    rc = sqlite3_prepare_v2(db, userBalance, -1, &stmt, nullptr);
-    if (rc != SQLITE_OK)
+bool loadAccounts(sqlite3 *db, const SymbolTable &symbols, AccountCache &accounts)
+{
+    sqlite3_stmt *stmt;
+    const char *usersSQL = "SELECT ID, first_name, last_name, usd_balance_cents FROM Users;";
+    if (sqlite3_prepare_v2(db, usersSQL, -1, &stmt, nullptr) != SQLITE_OK)
     {
-        std::cerr << "Failed to prepare balance check statement: " << sqlite3_errmsg(db) << std::endl;
-        sqlite3_close(db);
+        std::cerr << "Failed to prepare account load: " << sqlite3_errmsg(db) << std::endl;
         return false;
     }
-
-    // Bind user ID
-    sqlite3_bind_int(stmt, 1, user_id);
-
-    // Execute query
-    double usd_balance = 0.0;
-    if (sqlite3_step(stmt) == SQLITE_ROW)
+    bool ok = true;
+    while (ok && sqlite3_step(stmt) == SQLITE_ROW)
     {
-        usd_balance = sqlite3_column_double(stmt, 0);
+        int user_id = sqlite3_column_int(stmt, 0);
+        const char *first_name = (const char *)sqlite3_column_text(stmt, 1);
+        const char *last_name = (const char *)sqlite3_column_text(stmt, 2);
+        if (!accounts.addUser(user_id, first_name ? first_name : "", last_name ? last_name : "",
+                              sqlite3_column_int64(stmt, 3)))
+        {
+            std::cerr << "Cannot cache user ID " << user_id << " (IDs must be 1-" << ACCOUNT_CACHE_MAX_ID << ")" << std::endl;
+            ok = false;
+        }
     }
-
     sqlite3_finalize(stmt);
-    if (usd_balance < total_cost)
+    if (!ok)
     {
-        std::cerr << "User does not have enough funds! Balance: $ " << usd_balance << ", Required: " << total_cost << std::endl;
-        sqlite3_close(db);
         return false;
     }
 
-    const char *deductBalanceSQL = "UPDATE Users SET usd_balance = usd_balance - ? WHERE ID = ?;";
-
-    rc = sqlite3_prepare_v2(db, deductBalanceSQL, -1, &stmt, nullptr);
-    if (rc != SQLITE_OK)
+    const char *positionsSQL = "SELECT user_id, stock_symbol, stock_balance_micros FROM Stocks;";
+    if (sqlite3_prepare_v2(db, positionsSQL, -1, &stmt, nullptr) != SQLITE_OK)
     {
-        std::cerr << "Failed to prepare balance deduction statement: " << sqlite3_errmsg(db) << std::endl;
-        sqlite3_close(db);
+        std::cerr << "Failed to prepare position load: " << sqlite3_errmsg(db) << std::endl;
         return false;
     }
-
-    // Bind total cost and user ID
-    sqlite3_bind_double(stmt, 1, total_cost);
-    sqlite3_bind_int(stmt, 2, user_id);
-
-    // Execute update
-    rc = sqlite3_step(stmt);
-    if (rc != SQLITE_DONE)
+    while (sqlite3_step(stmt) == SQLITE_ROW)
     {
-        std::cerr << "Error updating user balance: " << sqlite3_errmsg(db) << std::endl;
-        sqlite3_finalize(stmt);
-        sqlite3_close(db);
-        return false;
+        int user_id = sqlite3_column_int(stmt, 0);
+        const char *symbol = (const char *)sqlite3_column_text(stmt, 1);
+        if (!accounts.addPosition(user_id, symbols.find(symbol ? symbol : ""), sqlite3_column_int64(stmt, 2)))
+        {
+            std::cerr << "Skipping position " << (symbol ? symbol : "") << " of user " << user_id
+                      << ": unknown user or unlisted symbol" << std::endl;
+        }
     }
-
     sqlite3_finalize(stmt);
-    sqlite3_close(db);
+
+    std::cout << "Account cache: " << accounts.users() << " user(s), " << accounts.positions()
+              << " position(s) loaded" << std::endl;
     return true;
 }
 
-bool sellStock(const std::string &stock_symbol,
-               double amount,
-               double price_per_stock,
-               int user_id,
-               const std::string &dbName)
+bool addUserCash(DbConnection &conn, int user_id, int64_t delta_cents)
 {
-    sqlite3 *db;
-    int rc;
     sqlite3_stmt *stmt;
-
-    if (!openDatabase(&db, dbName))
+    const char *updateCash = "UPDATE Users SET usd_balance_cents = usd_balance_cents + ? WHERE ID = ?;";
+    if (conn.statements.prepare(conn.db, updateCash, &stmt) != SQLITE_OK)
     {
+        std::cerr << "Failed to prepare balance update: " << sqlite3_errmsg(conn.db) << std::endl;
         return false;
     }
-
-    // Start transaction
-    rc = sqlite3_exec(db, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
-    if (rc != SQLITE_OK)
+    sqlite3_bind_int64(stmt, 1, delta_cents);
+    sqlite3_bind_int(stmt, 2, user_id);
+    int rc = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    if (rc != SQLITE_DONE || sqlite3_changes(conn.db) != 1)
     {
-        std::cerr << "Failed to begin transaction: " << sqlite3_errmsg(db) << std::endl;
-        sqlite3_close(db);
+        std::cerr << "Error updating balance of user " << user_id << ": " << sqlite3_errmsg(conn.db) << std::endl;
         return false;
     }
+    return true;
+}
 
-    // Check if the user exists
-    const char *userExists = "SELECT COUNT(*) FROM Users WHERE ID = ?;";
-    rc = sqlite3_prepare_v2(db, userExists, -1, &stmt, nullptr);
-    if (rc != SQLITE_OK)
+bool writeUserPosition(DbConnection &conn,
+                       const std::string &stock_symbol,
+                       const std::string &stock_name,
+                       int user_id,
+                       int64_t micros)
+{
+    sqlite3_stmt *stmt;
+    if (micros == 0)
     {
-        std::cerr << "Failed to prepare user existence check: " << sqlite3_errmsg(db) << std::endl;
-        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
-        sqlite3_close(db);
+        const char *deleteStockSQL = "DELETE FROM Stocks WHERE user_id = ? AND stock_symbol = ?;";
+        if (conn.statements.prepare(conn.db, deleteStockSQL, &stmt) != SQLITE_OK)
+        {
+            std::cerr << "Failed to prepare stock deletion: " << sqlite3_errmsg(conn.db) << std::endl;
+            return false;
+        }
+        sqlite3_bind_int(stmt, 1, user_id);
+        sqlite3_bind_text(stmt, 2, stock_symbol.c_str(), -1, SQLITE_STATIC);
+    }
+    else
+    {
+        // The unique index on (user_id, stock_symbol) turns a second insert
+        // into the update
+        const char *upsertPosition = R"(
+            INSERT INTO Stocks (stock_symbol, stock_name, stock_balance_micros, user_id)
+            VALUES (?, ?, ?, ?)
+            ON CONFLICT (user_id, stock_symbol) DO UPDATE SET stock_balance_micros = excluded.stock_balance_micros;
+        )";
+        if (conn.statements.prepare(conn.db, upsertPosition, &stmt) != SQLITE_OK)
+        {
+            std::cerr << "Failed to prepare position upsert: " << sqlite3_errmsg(conn.db) << std::endl;
+            return false;
+        }
+        sqlite3_bind_text(stmt, 1, stock_symbol.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 2, stock_name.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_int64(stmt, 3, micros);
+        sqlite3_bind_int(stmt, 4, user_id);
+    }
+    int rc = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    if (rc != SQLITE_DONE)
+    {
+        std::cerr << "Error updating position for user " << user_id << ": " << sqlite3_errmsg(conn.db) << std::endl;
         return false;
     }
+    return true;
+}
 
-    sqlite3_bind_int(stmt, 1, user_id);
-
-    bool userExistsFlag = false;
-    if (sqlite3_step(stmt) == SQLITE_ROW)
+bool buyStock(uint32_t symbol_id,
+              const std::string &stock_symbol,
+              int64_t amount_micros,
+              int64_t price_cents,
+              int user_id,
+              AccountBatch &accounts,
+              BalanceSink &sink,
+              int64_t &new_usd_cents,
+              int64_t &new_position_micros)
+{
+    int64_t total_cents;
+    if (!tradeValueCents(amount_micros, price_cents, total_cents, Rounding::Up))
     {
-        userExistsFlag = sqlite3_column_int(stmt, 0) > 0;
+        std::cerr << "Trade value out of range for user " << user_id << std::endl;
+        return false;
     }
 
-    sqlite3_finalize(stmt);
-
-    if (!userExistsFlag)
+    // Risk checks run against the cache; the database is only written to.
+    // The cost is reserved first so no other shard can spend it meanwhile.
+    int64_t usd_cents;
+    if (!accounts.cash(user_id, usd_cents))
     {
         std::cerr << "User ID " << user_id << " does not exist!" << std::endl;
-        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
-        sqlite3_close(db);
         return false;
     }
-
-    // Check if the stock exists and get the current balance
-    const char *stockExists = "SELECT stock_balance FROM Stocks WHERE stock_symbol = ? AND user_id = ?;";
-    rc = sqlite3_prepare_v2(db, stockExists, -1, &stmt, nullptr);
-    if (rc != SQLITE_OK)
+    int64_t position_micros = accounts.position(user_id, symbol_id);
+    if (position_micros > INT64_MAX - amount_micros)
     {
-        std::cerr << "Failed to prepare stock existence check: " << sqlite3_errmsg(db) << std::endl;
-        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
-        sqlite3_close(db);
+        std::cerr << "Position of user " << user_id << " in " << stock_symbol << " would overflow" << std::endl;
         return false;
     }
-
-    sqlite3_bind_text(stmt, 1, stock_symbol.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_int(stmt, 2, user_id);
-
-    double stockBalance = 0.0;
-    bool stockExistsFlag = false;
-
-    if (sqlite3_step(stmt) == SQLITE_ROW)
+    if (!accounts.reserveCash(user_id, total_cents))
     {
-        stockBalance = sqlite3_column_double(stmt, 0);
-        stockExistsFlag = stockBalance >= amount; // Ensure sufficient stock
+        std::cerr << "User does not have enough funds! Balance: $ " << formatCents(usd_cents)
+                  << ", Required: " << formatCents(total_cents) << std::endl;
+        return false;
     }
 
-    sqlite3_finalize(stmt);
-
-    if (!stockExistsFlag)
+    new_usd_cents = usd_cents - total_cents;
+    new_position_micros = position_micros + amount_micros;
+    if (!sink.addCash(user_id, -total_cents) ||
+        !sink.writePosition(user_id, symbol_id, new_position_micros))
     {
-        std::cerr << "Insufficient stock balance to sell. Available: " << stockBalance << ", Attempted to sell: " << amount << std::endl;
-        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
-        sqlite3_close(db);
+        accounts.releaseCash(user_id, total_cents);
         return false;
     }
+    accounts.spendCash(user_id, total_cents);
+    accounts.setPosition(user_id, symbol_id, new_position_micros);
+    return true;
+}
 
-    // Update or delete the stock record
-    if (stockBalance == amount)
+bool sellStock(uint32_t symbol_id,
+               const std::string &stock_symbol,
+               int64_t amount_micros,
+               int64_t price_cents,
+               int user_id,
+               AccountBatch &accounts,
+               BalanceSink &sink,
+               int64_t &new_usd_cents,
+               int64_t &new_position_micros)
+{
+    int64_t proceeds_cents;
+    if (!tradeValueCents(amount_micros, price_cents, proceeds_cents, Rounding::Down))
     {
-        const char *deleteStockSQL = "DELETE FROM Stocks WHERE stock_symbol = ? AND user_id = ?;";
-        rc = sqlite3_prepare_v2(db, deleteStockSQL, -1, &stmt, nullptr);
-        if (rc != SQLITE_OK)
-        {
-            std::cerr << "Failed to prepare stock deletion: " << sqlite3_errmsg(db) << std::endl;
-            sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
-            sqlite3_close(db);
-            return false;
-        }
-        sqlite3_bind_text(stmt, 1, stock_symbol.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_int(stmt, 2, user_id);
-
-        rc = sqlite3_step(stmt);
-        sqlite3_finalize(stmt);
-
-        if (rc != SQLITE_DONE)
-        {
-            std::cerr << "Error deleting stock: " << sqlite3_errmsg(db) << std::endl;
-            sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
-            sqlite3_close(db);
-            return false;
-        }
+        std::cerr << "Trade value out of range for user " << user_id << std::endl;
+        return false;
     }
-    else
-    {
-        const char *updateStockSQL = "UPDATE Stocks SET stock_balance = stock_balance - ? WHERE stock_symbol = ? AND user_id = ?;";
-        rc = sqlite3_prepare_v2(db, updateStockSQL, -1, &stmt, nullptr);
-        if (rc != SQLITE_OK)
-        {
-            std::cerr << "Failed to prepare stock balance update: " << sqlite3_errmsg(db) << std::endl;
-            sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
-            sqlite3_close(db);
-            return false;
-        }
-        sqlite3_bind_double(stmt, 1, amount);
-        sqlite3_bind_text(stmt, 2, stock_symbol.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_int(stmt, 3, user_id);
-
-        rc = sqlite3_step(stmt);
-        sqlite3_finalize(stmt);
 
-        if (rc != SQLITE_DONE)
-        {
-            std::cerr << "Error updating stock balance: " << sqlite3_errmsg(db) << std::endl;
-            sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
-            sqlite3_close(db);
-            return false;
-        }
+    int64_t usd_cents;
+    if (!accounts.cash(user_id, usd_cents))
+    {
+        std::cerr << "User ID " << user_id << " does not exist!" << std::endl;
+        return false;
     }
-
-    // Update user's USD balance
-    double total_earnings = amount * price_per_stock;
-    const char *updateBalanceSQL = "UPDATE Users SET usd_balance = usd_balance + ? WHERE ID = ?;";
-    rc = sqlite3_prepare_v2(db, updateBalanceSQL, -1, &stmt, nullptr);
-    if (rc != SQLITE_OK)
+    int64_t position_micros = accounts.position(user_id, symbol_id);
+    if (position_micros < amount_micros)
     {
-        std::cerr << "Failed to prepare balance update: " << sqlite3_errmsg(db) << std::endl;
-        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
-        sqlite3_close(db);
+        std::cerr << "Insufficient " << stock_symbol << " balance for user " << user_id
+                  << " to sell " << formatMicros(amount_micros) << std::endl;
         return false;
     }
-
-    sqlite3_bind_double(stmt, 1, total_earnings);
-    sqlite3_bind_int(stmt, 2, user_id);
-
-    rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-
-    if (rc != SQLITE_DONE)
+    if (usd_cents > INT64_MAX - proceeds_cents)
     {
-        std::cerr << "Error updating user balance: " << sqlite3_errmsg(db) << std::endl;
-        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
-        sqlite3_close(db);
+        std::cerr << "Balance of user " << user_id << " would overflow" << std::endl;
         return false;
     }
 
-    // Commit transaction so the sell actually works
-    rc = sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
-    if (rc != SQLITE_OK)
+    // A position sold down to exactly nothing is removed
+    new_position_micros = position_micros - amount_micros;
+    new_usd_cents = usd_cents + proceeds_cents;
+    if (!sink.writePosition(user_id, symbol_id, new_position_micros) ||
+        !sink.addCash(user_id, proceeds_cents))
     {
-        std::cerr << "Failed to commit transaction: " << sqlite3_errmsg(db) << std::endl;
-        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
-        sqlite3_close(db);
         return false;
     }
-
-    sqlite3_close(db);
+    accounts.setPosition(user_id, symbol_id, new_position_micros);
+    accounts.creditCash(user_id, proceeds_cents);
     return true;
 }
-bool listStock(const std::string &dbName, int user_id)
+
+bool listStock(int user_id, DbConnection &conn)
 {
-    sqlite3 *db;
+    sqlite3 *db = conn.db;
     sqlite3_stmt *stmt;
 
-    if (openDatabase(&db, dbName))
+    if (db)
     {
-        const char *listStocksSQL = "SELECT id, stock_symbol, stock_balance, user_id FROM Stocks WHERE user_id = ?;";
+        const char *listStocksSQL = "SELECT id, stock_symbol, stock_balance_micros, user_id FROM Stocks WHERE user_id = ?;";
 
         // Prepare the SQL query
-        if (sqlite3_prepare_v2(db, listStocksSQL, -1, &stmt, nullptr) != SQLITE_OK)
+        if (conn.statements.prepare(db, listStocksSQL, &stmt) != SQLITE_OK)
         {
             std::cerr << "Error preparing LIST query: " << sqlite3_errmsg(db) << std::endl;
-            sqlite3_finalize(stmt);
-            sqlite3_close(db);
+            sqlite3_reset(stmt);
             return false;
         }
 
@@ -496,38 +640,34 @@ bool listStock(const std::string &dbName, int user_id)
         {
             int id = sqlite3_column_int(stmt, 0);
             const char *stock_symbol = (const char *)sqlite3_column_text(stmt, 1);
-            double stock_balance = sqlite3_column_double(stmt, 2);
+            int64_t stock_balance = sqlite3_column_int64(stmt, 2);
             int user_id = sqlite3_column_int(stmt, 3);
 
             // Print or process the stock record (you could also return this data)
             std::cout << "ID: " << id << ", Symbol: " << stock_symbol
-                      << ", Balance: " << stock_balance << ", User ID: " << user_id << std::endl;
+                      << ", Balance: " << formatMicros(stock_balance) << ", User ID: " << user_id << std::endl;
         }
 
         // Clean up
-        sqlite3_finalize(stmt);
-        sqlite3_close(db);
+        sqlite3_reset(stmt);
     }
     else
     {
-        std::cerr << "Failed to open the database!" << std::endl;
+        std::cerr << "No database connection!" << std::endl;
         return false;
     }
 
     return true;
 }
-bool getUserBalance(int user_id, std::string &first_name, std::string &last_name, double &usd_balance, const std::string &dbName)
+bool getUserBalance(int user_id, std::string &first_name, std::string &last_name, int64_t &usd_cents, DbConnection &conn)
 {
-    sqlite3 *db;
+    sqlite3 *db = conn.db;
     sqlite3_stmt *stmt;
-    if (!openDatabase(&db, dbName))
-        return false;
 
-    const char *query = "SELECT first_name, last_name, usd_balance FROM Users WHERE ID = ?;";
-    if (sqlite3_prepare_v2(db, query, -1, &stmt, nullptr) != SQLITE_OK)
+    const char *query = "SELECT first_name, last_name, usd_balance_cents FROM Users WHERE ID = ?;";
+    if (conn.statements.prepare(db, query, &stmt) != SQLITE_OK)
     {
         std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db) << std::endl;
-        sqlite3_close(db);
         return false;
     }
 
@@ -538,12 +678,11 @@ bool getUserBalance(int user_id, std::string &first_name, std::string &last_name
     {
         first_name = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
         last_name = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1));
-        usd_balance = sqlite3_column_double(stmt, 2);
+        usd_cents = sqlite3_column_int64(stmt, 2);
         found = true;
     }
 
-    sqlite3_finalize(stmt);
-    sqlite3_close(db);
+    sqlite3_reset(stmt);
     return found;
 }
 
@@ -2,31 +2,77 @@
 #define DATABASE_H
 
 #include <sqlite3.h>
+#include <cstdint>
 #include <string>
 #include <iostream>
 
-bool openDatabase(sqlite3 **db, const std::string &dbName);
+struct DbConnection;
+struct DbProfile;
+class AccountCache;
+class AccountBatch;
+class BalanceSink;
+class SymbolTable;
 
-bool initializeDatabase(const std::string &dbName);
+// Opens one connection. Request handling does not call this directly; it
+// borrows a long-lived connection from DbPool instead. A read-only handle
+// can never take the write lock, and in WAL mode reads from a snapshot
+// without blocking the writer or being blocked by it.
+bool openDatabase(sqlite3 **db, const std::string &dbName, bool readOnly = false);
 
-bool buyStock(const std::string &stock_symbol,
-              const std::string &stock_name,
-              double amount,
-              double price_per_stock,
+bool initializeDatabase(const std::string &dbName, const DbProfile &profile);
+
+// Lists the symbols in a text file, one "SYMBOL [name]" per line ('#'
+// starts a comment), in the Symbols table; already listed ones get the new name
+bool importSymbols(sqlite3 *db, const std::string &path);
+
+// Fill the symbol master and then the account cache, whose positions are
+// keyed by symbol ID; run once at startup
+bool loadSymbols(sqlite3 *db, SymbolTable &symbols);
+bool loadAccounts(sqlite3 *db, const SymbolTable &symbols, AccountCache &accounts);
+
+// Persist a change to one user's cash balance, or their new position in
+// one symbol (0 deletes the row), inside the transaction open on conn
+bool addUserCash(DbConnection &conn, int user_id, int64_t delta_cents);
+bool writeUserPosition(DbConnection &conn,
+                       const std::string &stock_symbol,
+                       const std::string &stock_name,
+                       int user_id,
+                       int64_t micros);
+
+// BUY and SELL of the listed symbol symbol_id (stock_symbol is its ticker,
+// for messages) check funds and holdings against accounts rather than
+// SQLite (a BUY reserves its cost, see AccountCache), hand the new
+// balances to sink and stage them in accounts for the caller to publish,
+// and return them. Amounts are micro-shares and prices and balances cents
+// (see fixed_point.h). With write-through the sink is the transaction or
+// savepoint the caller opened (see GroupCommitter), and on false the
+// caller must roll back: part of the trade may already have been written.
+// With write-behind it is the flush queue.
+bool buyStock(uint32_t symbol_id,
+              const std::string &stock_symbol,
+              int64_t amount_micros,
+              int64_t price_cents,
               int user_id,
-              const std::string &dbName);
+              AccountBatch &accounts,
+              BalanceSink &sink,
+              int64_t &new_usd_cents,
+              int64_t &new_position_micros);
 
-bool sellStock(const std::string &stock_symbol,
-               double amount,
-               double price_per_stock,
+bool sellStock(uint32_t symbol_id,
+               const std::string &stock_symbol,
+               int64_t amount_micros,
+               int64_t price_cents,
                int user_id,
-               const std::string &dbName);
-bool listStock(const std::string &dbName);
+               AccountBatch &accounts,
+               BalanceSink &sink,
+               int64_t &new_usd_cents,
+               int64_t &new_position_micros);
+bool listStock(int user_id, DbConnection &conn);
 
 bool getUserBalance(int user_id, 
                     std::string &first_name,
                     std::string &last_name,
-                    double &usd_balance,
-                    const std::string &dbName);
+                    int64_t &usd_cents,
+                    DbConnection &conn);
 
 #endif
@@ -0,0 +1,182 @@
+#include <iostream>
+#include "db_pool.h"
+#include "database.h"
+
+// Errors after which a handle cannot be trusted: the file went away, the
+// disk failed or what is on it is no longer a database
+static bool isConnectionError(int rc)
+{
+    switch (rc & 0xff)
+    {
+    case SQLITE_IOERR:
+    case SQLITE_CORRUPT:
+    case SQLITE_NOTADB:
+    case SQLITE_CANTOPEN:
+        return true;
+    default:
+        return false;
+    }
+}
+
+DbPool::DbPool(const std::string &dbName, size_t readerCount, const DbProfile &profile)
+    : dbName(dbName), profile(profile)
+{
+    for (size_t i = 0; i < readerCount; i++)
+    {
+        auto conn = std::make_unique<DbConnection>();
+        conn->reader = true;
+        readers.push_back(std::move(conn));
+    }
+}
+
+DbPool::~DbPool()
+{
+    close();
+}
+
+bool DbPool::open()
+{
+    if (!connect(writer))
+    {
+        return false;
+    }
+    reportDbSettings(writer.db, profile);
+    if (!isWalMode(writer.db))
+    {
+        std::cerr << "Warning: without WAL, LIST and trades lock each other out; pick a WAL profile" << std::endl;
+    }
+
+    idleReaders.clear();
+    for (auto &conn : readers)
+    {
+        if (!connect(*conn))
+        {
+            close();
+            return false;
+        }
+        idleReaders.push_back(conn.get());
+    }
+
+    std::cout << "Database pool ready: 1 writer, " << readers.size() << " read-only reader(s)" << std::endl;
+    return true;
+}
+
+void DbPool::close()
+{
+    disconnect(writer);
+    for (auto &conn : readers)
+    {
+        disconnect(*conn);
+    }
+}
+
+bool DbPool::connect(DbConnection &conn)
+{
+    conn.broken = false;
+    if (!openDatabase(&conn.db, dbName, conn.reader) || !applyDbConnectionSettings(conn.db, profile))
+    {
+        sqlite3_close(conn.db);
+        conn.db = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void DbPool::disconnect(DbConnection &conn)
+{
+    // sqlite3_close() refuses to close a handle with live statements
+    conn.statements.clear();
+    if (conn.db)
+    {
+        sqlite3_close(conn.db);
+        conn.db = nullptr;
+    }
+}
+
+void DbPool::statementStats(uint64_t &hits, uint64_t &misses, size_t &cached) const
+{
+    // The counters are atomics; size() is only read once the workers are idle
+    hits = writer.statements.hits();
+    misses = writer.statements.misses();
+    cached = writer.statements.size();
+    for (auto &conn : readers)
+    {
+        hits += conn->statements.hits();
+        misses += conn->statements.misses();
+        cached += conn->statements.size();
+    }
+}
+
+DbConnection *DbPool::acquire(DbRole role)
+{
+    DbConnection *conn = nullptr;
+    if (role == DbRole::Reader && !readers.empty())
+    {
+        std::unique_lock<std::mutex> lock(readerMtx);
+        readerCv.wait(lock, [this]
+                      { return !idleReaders.empty(); });
+        conn = idleReaders.back();
+        idleReaders.pop_back();
+    }
+    else
+    {
+        writerMtx.lock();
+        conn = &writer;
+    }
+
+    // Reopen a handle retired after an error; the lease reports failure if
+    // that does not work either, and the next lease tries again
+    if (!conn->db)
+    {
+        std::cerr << "Reconnecting to database " << dbName << std::endl;
+        if (connect(*conn))
+        {
+            reconnectCount.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    return conn;
+}
+
+void DbPool::release(DbConnection *conn)
+{
+    if (conn->db)
+    {
+        if (isConnectionError(sqlite3_errcode(conn->db)))
+        {
+            std::cerr << "Database connection failed: " << sqlite3_errmsg(conn->db) << std::endl;
+            conn->broken = true;
+        }
+        else if (!sqlite3_get_autocommit(conn->db))
+        {
+            // A caller bailed out in the middle of a transaction
+            sqlite3_exec(conn->db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        }
+
+        if (conn->broken)
+        {
+            disconnect(*conn);
+        }
+    }
+
+    if (!conn->reader)
+    {
+        writerMtx.unlock();
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(readerMtx);
+        idleReaders.push_back(conn);
+    }
+    readerCv.notify_one();
+}
+
+DbLease::DbLease(DbPool &pool, DbRole role)
+    : pool(pool), conn(pool.acquire(role))
+{
+}
+
+DbLease::~DbLease()
+{
+    pool.release(conn);
+}
@@ -0,0 +1,101 @@
+#ifndef DB_POOL_H
+#define DB_POOL_H
+
+#include <sqlite3.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "db_profile.h"
+#include "statement_cache.h"
+
+// One long-lived SQLite handle owned by a DbPool, with the statements
+// compiled on it
+struct DbConnection
+{
+    sqlite3 *db = nullptr;
+    StatementCache statements;
+    bool reader = false;
+    bool broken = false; // Closed and reopened before it is handed out again
+};
+
+enum class DbRole
+{
+    Writer, // The single connection that changes data
+    Reader  // Any free read connection; falls back to the writer if there are none
+};
+
+// Process-wide set of connections opened once at startup: one writer plus
+// readerCount read-only readers. In WAL mode each reader works from its own
+// snapshot while the writer commits, so reports never stall trades. Worker
+// threads borrow them through a DbLease, so no request pays for opening the
+// file or parsing the schema. A connection that hits an I/O or corruption
+// error is reopened on its next use. Every connection gets the
+// per-connection settings of profile.
+class DbPool
+{
+public:
+    DbPool(const std::string &dbName, size_t readerCount, const DbProfile &profile);
+    ~DbPool();
+
+    DbPool(const DbPool &) = delete;
+    DbPool &operator=(const DbPool &) = delete;
+
+    bool open();
+    void close();
+
+    const std::string &name() const { return dbName; }
+    size_t readerCount() const { return readers.size(); }
+    uint64_t reconnects() const { return reconnectCount.load(std::memory_order_relaxed); }
+
+    // Statement cache totals over every connection
+    void statementStats(uint64_t &hits, uint64_t &misses, size_t &cached) const;
+
+private:
+    friend class DbLease;
+
+    DbConnection *acquire(DbRole role);
+    void release(DbConnection *conn);
+    bool connect(DbConnection &conn);
+    void disconnect(DbConnection &conn);
+
+    std::string dbName;
+    DbProfile profile;
+
+    DbConnection writer;
+    std::mutex writerMtx; // Held for the whole lease: SQLite allows one writer at a time anyway
+
+    std::vector<std::unique_ptr<DbConnection>> readers;
+    std::vector<DbConnection *> idleReaders;
+    std::mutex readerMtx;
+    std::condition_variable readerCv;
+
+    std::atomic<uint64_t> reconnectCount{0};
+};
+
+// Exclusive use of one pooled connection for as long as the lease lives.
+// Any transaction still open when it ends is rolled back.
+class DbLease
+{
+public:
+    DbLease(DbPool &pool, DbRole role);
+    ~DbLease();
+
+    DbLease(const DbLease &) = delete;
+    DbLease &operator=(const DbLease &) = delete;
+
+    // False when the connection could not be (re)opened
+    bool ok() const { return conn->db != nullptr; }
+    sqlite3 *db() const { return conn->db; }
+    DbConnection &connection() const { return *conn; }
+
+private:
+    DbPool &pool;
+    DbConnection *conn;
+};
+
+#endif
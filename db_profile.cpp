@@ -0,0 +1,135 @@
+#include <iostream>
+#include <cctype>
+#include <cstdlib>
+#include "db_profile.h"
+
+// strict:        WAL, fsync on every commit. Nothing acknowledged is ever lost.
+// wal-normal:    WAL, fsync at checkpoints only. A power cut can lose the last
+//                few commits but never corrupts the file.
+// memory-mapped: wal-normal, plus reads straight from a 1 GiB mapping.
+// rollback:      the classic rollback journal with FULL sync, for file systems
+//                without the shared memory WAL needs (e.g. network mounts).
+static const DbProfile profiles[] = {
+    {"strict", "WAL", "FULL", 0, 16 * 1024, 4096, "DEFAULT"},
+    {"wal-normal", "WAL", "NORMAL", 0, 64 * 1024, 4096, "MEMORY"},
+    {"memory-mapped", "WAL", "NORMAL", 1024LL * 1024 * 1024, 64 * 1024, 4096, "MEMORY"},
+    {"rollback", "DELETE", "FULL", 0, 2 * 1024, 4096, "DEFAULT"},
+};
+
+bool findDbProfile(const std::string &name, DbProfile &out)
+{
+    for (const DbProfile &profile : profiles)
+    {
+        if (profile.name == name)
+        {
+            out = profile;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string dbProfileNames()
+{
+    std::string names;
+    for (const DbProfile &profile : profiles)
+    {
+        if (!names.empty())
+        {
+            names += ", ";
+        }
+        names += profile.name;
+    }
+    return names;
+}
+
+static bool execPragma(sqlite3 *db, const std::string &pragma)
+{
+    std::string sql = "PRAGMA " + pragma + ";";
+    char *errMsg = nullptr;
+
+    // Pragmas like journal_mode answer with a row; exec just discards it
+    if (sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &errMsg) != SQLITE_OK)
+    {
+        std::cerr << "Failed to set " << pragma << ": " << errMsg << std::endl;
+        sqlite3_free(errMsg);
+        return false;
+    }
+    return true;
+}
+
+static std::string queryPragma(sqlite3 *db, const char *name)
+{
+    std::string sql = std::string("PRAGMA ") + name + ";";
+    sqlite3_stmt *stmt;
+    std::string value = "?";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) == SQLITE_OK &&
+        sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        const unsigned char *text = sqlite3_column_text(stmt, 0);
+        value = text ? (const char *)text : "";
+    }
+    sqlite3_finalize(stmt);
+    return value;
+}
+
+bool applyDbFileSettings(sqlite3 *db, const DbProfile &profile)
+{
+    // page_size has to come first: it is ignored once the file has pages,
+    // and cannot change at all once it is in WAL mode
+    if (!execPragma(db, "page_size = " + std::to_string(profile.pageSize)))
+    {
+        return false;
+    }
+
+    std::string wanted = profile.journalMode;
+    if (!execPragma(db, "journal_mode = " + wanted))
+    {
+        return false;
+    }
+
+    // SQLite keeps the old mode rather than failing when it cannot switch
+    std::string mode = queryPragma(db, "journal_mode");
+    for (char &c : wanted)
+    {
+        c = (char)tolower((unsigned char)c);
+    }
+    if (mode != wanted)
+    {
+        std::cerr << "Database stayed in journal_mode " << mode << " instead of " << wanted << std::endl;
+    }
+    return true;
+}
+
+bool applyDbConnectionSettings(sqlite3 *db, const DbProfile &profile)
+{
+    // A negative cache_size is in KiB rather than pages
+    return execPragma(db, "synchronous = " + profile.synchronous) &&
+           execPragma(db, "mmap_size = " + std::to_string(profile.mmapSize)) &&
+           execPragma(db, "cache_size = -" + std::to_string(profile.cacheSizeKb)) &&
+           execPragma(db, "temp_store = " + profile.tempStore);
+}
+
+bool isWalMode(sqlite3 *db)
+{
+    return queryPragma(db, "journal_mode") == "wal";
+}
+
+void reportDbSettings(sqlite3 *db, const DbProfile &profile)
+{
+    static const char *synchronousNames[] = {"OFF", "NORMAL", "FULL", "EXTRA"};
+    static const char *tempStoreNames[] = {"DEFAULT", "FILE", "MEMORY"};
+
+    std::string synchronous = queryPragma(db, "synchronous");
+    std::string tempStore = queryPragma(db, "temp_store");
+    int sync = atoi(synchronous.c_str());
+    int temp = atoi(tempStore.c_str());
+
+    std::cout << "Database profile " << profile.name << ": journal_mode=" << queryPragma(db, "journal_mode")
+              << " synchronous=" << (sync >= 0 && sync <= 3 ? synchronousNames[sync] : synchronous.c_str())
+              << " mmap_size=" << queryPragma(db, "mmap_size")
+              << " cache_size=" << queryPragma(db, "cache_size")
+              << " page_size=" << queryPragma(db, "page_size")
+              << " temp_store=" << (temp >= 0 && temp <= 2 ? tempStoreNames[temp] : tempStore.c_str())
+              << std::endl;
+}
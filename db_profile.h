@@ -0,0 +1,46 @@
+#ifndef DB_PROFILE_H
+#define DB_PROFILE_H
+
+#include <sqlite3.h>
+#include <cstdint>
+#include <string>
+
+#define DEFAULT_DB_PROFILE "strict"
+
+// A named set of SQLite durability/performance settings chosen at startup.
+// journalMode and pageSize belong to the database file and are applied once
+// by initializeDatabase(); the rest are per connection and applied to every
+// connection DbPool opens.
+struct DbProfile
+{
+    std::string name;
+    std::string journalMode; // WAL lets readers run alongside the writer
+    std::string synchronous; // FULL fsyncs every commit; NORMAL only at checkpoints in WAL mode
+    int64_t mmapSize;        // Bytes of the file read through mmap; 0 disables
+    int64_t cacheSizeKb;     // Page cache per connection
+    int pageSize;            // Only takes effect when the file is created
+    std::string tempStore;   // Where temporary tables and indexes live
+};
+
+// Looks up one of the built-in profiles: strict, wal-normal,
+// memory-mapped or rollback
+bool findDbProfile(const std::string &name, DbProfile &out);
+
+// Comma-separated profile names, for usage messages
+std::string dbProfileNames();
+
+// Applies the file-level settings; needs the only open connection
+bool applyDbFileSettings(sqlite3 *db, const DbProfile &profile);
+
+// Applies the per-connection settings
+bool applyDbConnectionSettings(sqlite3 *db, const DbProfile &profile);
+
+// Whether the file is in WAL mode, where readers and the writer do not block
+// each other
+bool isWalMode(sqlite3 *db);
+
+// Prints what SQLite actually ended up using, which can differ from the
+// profile (page_size of an existing file, mmap capped by the build)
+void reportDbSettings(sqlite3 *db, const DbProfile &profile);
+
+#endif
@@ -0,0 +1,476 @@
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include "event_loop.h"
+
+bool setNonBlocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0)
+    {
+        return false;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+EventLoop::EventLoop(int listen_s, WorkerPool &workers, const LoopLimits &limits, bool offerSharedMemory)
+    : ServerLoop(workers, limits), listen_s(listen_s), offerSharedMemory(offerSharedMemory)
+{
+}
+
+EventLoop::~EventLoop()
+{
+    closeAll();
+    if (epfd >= 0)
+    {
+        close(epfd);
+    }
+}
+
+bool EventLoop::init()
+{
+    if (!setNonBlocking(listen_s))
+    {
+        perror("Failed to make listening socket non-blocking");
+        return false;
+    }
+
+    if (!completions.init() || !initTimers())
+    {
+        return false;
+    }
+
+    if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    {
+        perror("epoll_create1 failed");
+        return false;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = listen_s;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, listen_s, &ev) < 0)
+    {
+        perror("epoll_ctl on listening socket failed");
+        return false;
+    }
+
+    // Workers signal this eventfd whenever they post a finished command
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = completions.fd();
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, completions.fd(), &ev) < 0)
+    {
+        perror("epoll_ctl on completion queue failed");
+        return false;
+    }
+
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = timerFd();
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, timerFd(), &ev) < 0)
+    {
+        perror("epoll_ctl on timer failed");
+        return false;
+    }
+    return true;
+}
+
+void EventLoop::run()
+{
+    struct epoll_event events[MAX_EVENTS];
+
+    while (!shutdownRequested)
+    {
+        rearmTimers();
+
+        // Don't sleep while a client still has unread bytes we deferred
+        int n = epoll_wait(epfd, events, MAX_EVENTS, readsPending.empty() ? -1 : 0);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("epoll_wait failed");
+            break;
+        }
+
+        for (int i = 0; i < n && !shutdownRequested; i++)
+        {
+            int fd = events[i].data.fd;
+            if (fd == listen_s)
+            {
+                acceptClients();
+                continue;
+            }
+            if (fd == completions.fd())
+            {
+                handleCompletions();
+                continue;
+            }
+            if (fd == timerFd())
+            {
+                handleTimers();
+                continue;
+            }
+            auto wakeup = ringWakeups.find(fd);
+            if (wakeup != ringWakeups.end())
+            {
+                handleRingWakeup(wakeup->second);
+                continue;
+            }
+
+            auto it = connections.find(fd);
+            if (it == connections.end())
+            {
+                continue;
+            }
+            Connection &conn = it->second;
+
+            if (events[i].events & EPOLLERR)
+            {
+                closeConnection(fd);
+                continue;
+            }
+            if (events[i].events & EPOLLOUT)
+            {
+                if (!flushOutput(conn))
+                {
+                    closeConnection(fd);
+                    continue;
+                }
+                handleWritten(conn);
+                if (connections.find(fd) == connections.end())
+                {
+                    continue;
+                }
+            }
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))
+            {
+                handleRead(conn);
+            }
+        }
+
+        std::vector<int> retry;
+        retry.swap(readsPending);
+        for (int fd : retry)
+        {
+            auto it = connections.find(fd);
+            if (it != connections.end() && !shutdownRequested)
+            {
+                handleRead(it->second);
+            }
+        }
+    }
+
+    std::cout << "Shutting down the server..." << std::endl;
+    closeAll();
+}
+
+void EventLoop::acceptClients()
+{
+    // Edge-triggered: drain the accept queue until it would block
+    while (true)
+    {
+        struct sockaddr_storage addr; // TCP or Unix domain peer
+        socklen_t addr_len = sizeof(addr);
+        int new_s = accept4(listen_s, (struct sockaddr *)&addr, &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (new_s < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                perror("Accept failed");
+            }
+            return;
+        }
+
+        if (!admitConnection(new_s))
+        {
+            close(new_s);
+            continue;
+        }
+
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.fd = new_s;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, new_s, &ev) < 0)
+        {
+            perror("epoll_ctl on client socket failed");
+            close(new_s);
+            continue;
+        }
+
+        addConnection(new_s);
+    }
+}
+
+void EventLoop::handleRead(Connection &conn)
+{
+    if (conn.readPaused)
+    {
+        return; // resumeReading() brings us back here
+    }
+
+    // Edge-triggered: read everything available before going back to epoll,
+    // up to READ_BUDGET so one busy client cannot starve the rest.
+    // Bytes land straight in the connection's input buffer.
+    size_t budget = READ_BUDGET;
+    while (true)
+    {
+        if (budget < READ_CHUNK)
+        {
+            readsPending.push_back(conn.fd);
+            break;
+        }
+        ssize_t buf_len = recv(conn.fd, conn.input.prepare(READ_CHUNK), READ_CHUNK, 0);
+        if (buf_len > 0)
+        {
+            conn.input.commit(buf_len);
+            budget -= buf_len;
+            continue;
+        }
+        if (buf_len == 0)
+        {
+            conn.peerClosed = true;
+            break;
+        }
+        if (errno == EINTR)
+        {
+            continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            std::cout << "Client disconnected.\n";
+            closeConnection(conn.fd);
+            return;
+        }
+        break;
+    }
+
+    // After TRANSPORT SHM the socket only signals hangup; pick up anything
+    // still in the ring before acting on it
+    if (rings.count(conn.fd))
+    {
+        handleRingWakeup(conn.fd);
+        return;
+    }
+    handleInput(conn);
+}
+
+bool EventLoop::flushOutput(Connection &conn)
+{
+    auto ring = rings.find(conn.fd);
+    if (ring != rings.end())
+    {
+        return flushToRing(conn, *ring->second);
+    }
+
+    struct iovec iov[MAX_IOV];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+
+    // All queued responses go out in as few gathered writes as possible.
+    // sendmsg() rather than writev() so a vanished client cannot SIGPIPE us.
+    while (!conn.output.empty())
+    {
+        msg.msg_iovlen = conn.output.gather(iov, MAX_IOV);
+        ssize_t n = sendmsg(conn.fd, &msg, MSG_NOSIGNAL);
+        if (n > 0)
+        {
+            conn.output.consume(n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            // Socket buffer is full; EPOLLOUT will tell us when to resume
+            break;
+        }
+        return false;
+    }
+    return true;
+}
+
+void EventLoop::closeConnection(int fd)
+{
+    auto ring = rings.find(fd);
+    if (ring != rings.end())
+    {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, ring->second->serverEfd, nullptr);
+        ringWakeups.erase(ring->second->serverEfd);
+        rings.erase(ring);
+    }
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    connections.erase(fd);
+}
+
+bool EventLoop::attachSharedMemory(Connection &conn)
+{
+    if (!offerSharedMemory)
+    {
+        return false;
+    }
+
+    auto channel = std::make_unique<ShmChannel>();
+    if (!channel->create())
+    {
+        return false;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = channel->serverEfd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, channel->serverEfd, &ev) < 0)
+    {
+        perror("epoll_ctl on shared ring failed");
+        return false;
+    }
+
+    // "200 OK" and the memfd plus both eventfds travel in one message
+    const char reply[] = "200 OK\n";
+    int fds[3] = {channel->memfd, channel->serverEfd, channel->clientEfd};
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+
+    struct iovec iov;
+    iov.iov_base = (void *)reply;
+    iov.iov_len = sizeof(reply) - 1;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (sendmsg(conn.fd, &msg, MSG_NOSIGNAL) != (ssize_t)iov.iov_len)
+    {
+        perror("Failed to hand shared ring to client");
+        epoll_ctl(epfd, EPOLL_CTL_DEL, channel->serverEfd, nullptr);
+        return false;
+    }
+    channel->closeMemfd(); // The client has its own copy; the mapping stays
+
+    ringWakeups[channel->serverEfd] = conn.fd;
+    rings[conn.fd] = std::move(channel);
+    std::cout << "Client moved to shared-memory rings." << std::endl;
+    return true;
+}
+
+void EventLoop::resumeReading(Connection &conn)
+{
+    // The edge that arrived while paused is gone, so read without waiting
+    readsPending.push_back(conn.fd);
+}
+
+void EventLoop::handleRingWakeup(int fd)
+{
+    auto it = connections.find(fd);
+    if (it == connections.end())
+    {
+        return;
+    }
+    Connection &conn = it->second;
+    ShmChannel &channel = *rings[fd];
+
+    // Same as handleRead, but the bytes come out of the request ring. Park
+    // only once it is empty so the client signals us on its next write.
+    ShmChannel::drainSignal(channel.serverEfd);
+    while (!conn.readPaused)
+    {
+        size_t n = channel.toServer.read(conn.input.prepare(READ_CHUNK), READ_CHUNK);
+        if (n == SHM_RING_BROKEN)
+        {
+            std::cout << "Client corrupted its shared ring; disconnecting.\n";
+            closeConnection(fd);
+            return;
+        }
+        if (n > 0)
+        {
+            conn.input.commit(n);
+            continue;
+        }
+        if (channel.toServer.parkReader())
+        {
+            break;
+        }
+    }
+    if (channel.toServer.writerShouldWake())
+    {
+        ShmChannel::signal(channel.clientEfd);
+    }
+
+    // Also how a full response ring gets retried once the client drains it
+    handleInput(conn);
+}
+
+bool EventLoop::flushToRing(Connection &conn, ShmChannel &channel)
+{
+    struct iovec iov[MAX_IOV];
+    bool wrote = false;
+
+    while (!conn.output.empty())
+    {
+        int count = conn.output.gather(iov, MAX_IOV);
+        size_t total = 0;
+        bool full = false;
+        for (int i = 0; i < count && !full; i++)
+        {
+            size_t n = channel.toClient.write((const char *)iov[i].iov_base, iov[i].iov_len);
+            if (n == SHM_RING_BROKEN)
+            {
+                std::cout << "Client corrupted its shared ring; disconnecting.\n";
+                return false;
+            }
+            total += n;
+            full = n < iov[i].iov_len;
+        }
+        conn.output.consume(total);
+        wrote = wrote || total > 0;
+
+        // The client's next read wakes us through serverEfd
+        if (full && channel.toClient.parkWriter())
+        {
+            break;
+        }
+    }
+
+    if (wrote && channel.toClient.readerShouldWake())
+    {
+        ShmChannel::signal(channel.clientEfd);
+    }
+    return true;
+}
+
+void EventLoop::closeAll()
+{
+    for (auto &entry : connections)
+    {
+        close(entry.first);
+    }
+    connections.clear();
+    ringWakeups.clear();
+    rings.clear();
+}
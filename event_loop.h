@@ -0,0 +1,51 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "server_loop.h"
+#include "shm_ring.h"
+
+#define MAX_EVENTS 1024
+#define READ_BUDGET (256 * 1024) // Bytes read from one client before the others get a turn
+
+// Single-threaded, edge-triggered epoll reactor. Accepts clients on a
+// non-blocking listening socket and multiplexes all of them on one thread,
+// handing parsed commands to the worker pool.
+// With offerSharedMemory set (the Unix socket listener), clients may move
+// their byte stream onto a pair of shared-memory rings; the loop then
+// watches the ring's eventfd instead of reading the socket.
+class EventLoop : public ServerLoop
+{
+public:
+    EventLoop(int listen_s, WorkerPool &workers, const LoopLimits &limits, bool offerSharedMemory = false);
+    ~EventLoop() override;
+
+    bool init() override;
+    void run() override;
+
+protected:
+    bool flushOutput(Connection &conn) override;
+    void closeConnection(int fd) override;
+    bool attachSharedMemory(Connection &conn) override;
+    void resumeReading(Connection &conn) override;
+
+private:
+    void acceptClients();
+    void handleRead(Connection &conn);
+    void handleRingWakeup(int fd);
+    bool flushToRing(Connection &conn, ShmChannel &channel);
+    void closeAll();
+
+    int listen_s;
+    int epfd = -1;
+    bool offerSharedMemory;
+    std::unordered_map<int, std::unique_ptr<ShmChannel>> rings; // Keyed by client socket
+    std::unordered_map<int, int> ringWakeups;                   // Ring eventfd -> client socket
+    std::vector<int> readsPending; // Clients to read again without waiting for a new edge
+};
+
+bool setNonBlocking(int fd);
+
+#endif
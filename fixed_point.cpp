@@ -0,0 +1,101 @@
+#include "fixed_point.h"
+
+bool parseFixed(const std::string &text, int digits, int64_t &out)
+{
+    size_t i = 0;
+    bool negative = false;
+    if (i < text.size() && (text[i] == '-' || text[i] == '+'))
+    {
+        negative = text[i] == '-';
+        i++;
+    }
+
+    // Accumulate as a positive number, then scale up the missing decimals
+    const uint64_t limit = (uint64_t)INT64_MAX + (negative ? 1 : 0);
+    uint64_t value = 0;
+    int fraction = -1; // Decimals seen so far; -1 until the point
+    bool anyDigit = false;
+    for (; i < text.size(); i++)
+    {
+        char c = text[i];
+        if (c == '.' && fraction < 0)
+        {
+            fraction = 0;
+            continue;
+        }
+        if (c < '0' || c > '9')
+        {
+            return false;
+        }
+        if (fraction >= 0 && ++fraction > digits)
+        {
+            return false;
+        }
+        if (value > (limit - (uint64_t)(c - '0')) / 10)
+        {
+            return false;
+        }
+        value = value * 10 + (uint64_t)(c - '0');
+        anyDigit = true;
+    }
+    if (!anyDigit)
+    {
+        return false;
+    }
+
+    for (int d = fraction < 0 ? 0 : fraction; d < digits; d++)
+    {
+        if (value > limit / 10)
+        {
+            return false;
+        }
+        value *= 10;
+    }
+
+    out = negative ? (int64_t)(0 - value) : (int64_t)value;
+    return true;
+}
+
+std::string formatFixed(int64_t value, int digits, int minFraction)
+{
+    uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+    uint64_t scale = 1;
+    for (int d = 0; d < digits; d++)
+    {
+        scale *= 10;
+    }
+
+    std::string text = value < 0 ? "-" : "";
+    text += std::to_string(magnitude / scale);
+
+    // Fraction padded to digits, then trailing zeros trimmed to minFraction
+    std::string fraction = std::to_string(magnitude % scale);
+    fraction.insert(0, (size_t)digits - fraction.size(), '0');
+    size_t keep = fraction.size();
+    while (keep > (size_t)minFraction && fraction[keep - 1] == '0')
+    {
+        keep--;
+    }
+    if (keep > 0)
+    {
+        text += "." + fraction.substr(0, keep);
+    }
+    return text;
+}
+
+bool tradeValueCents(int64_t quantityMicros, int64_t priceCents, int64_t &valueCents, Rounding rounding)
+{
+    if (quantityMicros < 0 || priceCents < 0)
+    {
+        return false;
+    }
+    // 128-bit product: a million shares at a million dollars still fits
+    unsigned __int128 product = (unsigned __int128)quantityMicros * (uint64_t)priceCents;
+    unsigned __int128 value = (product + (rounding == Rounding::Up ? MICROS_PER_SHARE - 1 : 0)) / MICROS_PER_SHARE;
+    if (value > (unsigned __int128)INT64_MAX)
+    {
+        return false;
+    }
+    valueCents = (int64_t)value;
+    return true;
+}
@@ -0,0 +1,45 @@
+#ifndef FIXED_POINT_H
+#define FIXED_POINT_H
+
+#include <cstdint>
+#include <string>
+
+// Money and share quantities are scaled 64-bit integers everywhere: in the
+// database, in arithmetic and on the wire. Cash is in cents, quantities in
+// millionths of a share, so nothing ever rounds except a trade's value.
+//
+// A trade's value rounds against whoever would otherwise gain from the
+// rounding: what a buyer pays rounds up and what a seller is paid rounds
+// down, so a lot too small to be worth a cent still costs one and can
+// never be bought for nothing.
+#define CENT_DIGITS 2
+#define MICRO_DIGITS 6
+#define CENTS_PER_DOLLAR 100
+#define MICROS_PER_SHARE 1000000
+
+// Parses a plain decimal such as "12", "-0.5" or "3.25" into value * 10^digits.
+// Rejects more fractional digits than that, exponents, junk and anything
+// that does not fit in an int64.
+bool parseFixed(const std::string &text, int digits, int64_t &out);
+
+// Formats value / 10^digits, always with at least minFraction decimals
+// (and never more than digits)
+std::string formatFixed(int64_t value, int digits, int minFraction);
+
+inline bool parseCents(const std::string &text, int64_t &cents) { return parseFixed(text, CENT_DIGITS, cents); }
+inline bool parseMicros(const std::string &text, int64_t &micros) { return parseFixed(text, MICRO_DIGITS, micros); }
+inline std::string formatCents(int64_t cents) { return formatFixed(cents, CENT_DIGITS, CENT_DIGITS); }
+inline std::string formatMicros(int64_t micros) { return formatFixed(micros, MICRO_DIGITS, 0); }
+
+enum class Rounding
+{
+    Down, // Proceeds: what a seller is paid
+    Up    // Cost: what a buyer pays or has to set aside
+};
+
+// Cash value of quantityMicros shares at priceCents each, rounded to a
+// whole cent as asked. Both inputs must be non-negative; returns false if
+// the result does not fit in an int64.
+bool tradeValueCents(int64_t quantityMicros, int64_t priceCents, int64_t &valueCents, Rounding rounding);
+
+#endif
@@ -0,0 +1,189 @@
+#include <cstring>
+#include <cstdint>
+#include <sstream>
+#include "framing.h"
+
+void ByteBuffer::append(const char *bytes, size_t len)
+{
+    memcpy(prepare(len), bytes, len);
+    commit(len);
+}
+
+char *ByteBuffer::prepare(size_t len)
+{
+    if (buf.size() - writePos >= len)
+    {
+        return buf.data() + writePos;
+    }
+
+    // Reclaim the consumed front before growing
+    if (readPos > 0)
+    {
+        memmove(buf.data(), buf.data() + readPos, writePos - readPos);
+        writePos -= readPos;
+        readPos = 0;
+    }
+    if (buf.size() - writePos < len)
+    {
+        size_t newSize = buf.size() * 2;
+        if (newSize < writePos + len)
+        {
+            newSize = writePos + len;
+        }
+        buf.resize(newSize);
+    }
+    return buf.data() + writePos;
+}
+
+void ByteBuffer::consume(size_t len)
+{
+    readPos += len;
+    if (readPos >= writePos)
+    {
+        readPos = 0;
+        writePos = 0;
+    }
+}
+
+void OutputQueue::push(std::string &&segment)
+{
+    if (segment.empty())
+    {
+        return;
+    }
+    bytes += segment.size();
+    segments.push_back(std::move(segment));
+}
+
+int OutputQueue::gather(struct iovec *iov, int maxIov) const
+{
+    int count = 0;
+    size_t offset = frontOffset;
+    for (auto it = segments.begin(); it != segments.end() && count < maxIov; ++it)
+    {
+        iov[count].iov_base = (void *)(it->data() + offset);
+        iov[count].iov_len = it->size() - offset;
+        count++;
+        offset = 0;
+    }
+    return count;
+}
+
+void OutputQueue::consume(size_t len)
+{
+    bytes -= len;
+    while (len > 0)
+    {
+        size_t left = segments.front().size() - frontOffset;
+        if (len < left)
+        {
+            frontOffset += len;
+            return;
+        }
+        len -= left;
+        segments.pop_front();
+        frontOffset = 0;
+    }
+}
+
+void OutputQueue::swap(OutputQueue &other)
+{
+    segments.swap(other.segments);
+    std::swap(frontOffset, other.frontOffset);
+    std::swap(bytes, other.bytes);
+}
+
+FrameStatus decodeFrame(ByteBuffer &in, FrameMode mode, std::string &frame)
+{
+    const char *bytes = in.data();
+    size_t available = in.size();
+
+    if (mode != FrameMode::Text)
+    {
+        if (available < FRAME_HEADER_SIZE)
+        {
+            return FrameStatus::Incomplete;
+        }
+
+        const unsigned char *header = (const unsigned char *)bytes;
+        uint32_t len = ((uint32_t)header[0] << 24) | ((uint32_t)header[1] << 16) |
+                       ((uint32_t)header[2] << 8) | (uint32_t)header[3];
+        if (len > MAX_FRAME_SIZE)
+        {
+            return FrameStatus::Invalid;
+        }
+        if (available < FRAME_HEADER_SIZE + len)
+        {
+            return FrameStatus::Incomplete;
+        }
+
+        frame.assign(bytes + FRAME_HEADER_SIZE, len);
+        in.consume(FRAME_HEADER_SIZE + len);
+        return FrameStatus::Complete;
+    }
+
+    // Text mode: the older client ends commands with a NUL, people typing
+    // into a terminal end them with a newline
+    for (size_t i = 0; i < available; i++)
+    {
+        if (bytes[i] == '\0' || bytes[i] == '\n')
+        {
+            size_t len = i;
+            if (len > 0 && bytes[len - 1] == '\r')
+            {
+                len--;
+            }
+            frame.assign(bytes, len);
+            in.consume(i + 1);
+            return FrameStatus::Complete;
+        }
+    }
+    return available > MAX_FRAME_SIZE ? FrameStatus::Invalid : FrameStatus::Incomplete;
+}
+
+void encodeFrame(OutputQueue &out, FrameMode mode, std::string payload)
+{
+    if (mode != FrameMode::Text)
+    {
+        uint32_t len = (uint32_t)payload.size();
+        char header[FRAME_HEADER_SIZE] = {
+            (char)(len >> 24), (char)(len >> 16), (char)(len >> 8), (char)len};
+        out.push(std::string(header, FRAME_HEADER_SIZE));
+    }
+    out.push(std::move(payload));
+}
+
+bool parseFramingRequest(const std::string &command, FrameMode &mode, bool &valid)
+{
+    std::istringstream iss(command);
+    std::string word, name, extra;
+    iss >> word;
+    if (word != "FRAMING")
+    {
+        return false;
+    }
+
+    valid = true;
+    iss >> name;
+    if (name == "TEXT")
+    {
+        mode = FrameMode::Text;
+    }
+    else if (name == "LENGTH")
+    {
+        mode = FrameMode::LengthPrefixed;
+    }
+    else if (name == "BINARY")
+    {
+        mode = FrameMode::Binary;
+    }
+    else
+    {
+        valid = false;
+    }
+    if (iss >> extra)
+    {
+        valid = false;
+    }
+    return true;
+}
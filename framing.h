@@ -0,0 +1,91 @@
+#ifndef FRAMING_H
+#define FRAMING_H
+
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <vector>
+#include <sys/uio.h>
+
+#define FRAME_HEADER_SIZE 4
+#define MAX_FRAME_SIZE (1024 * 1024)
+
+// How messages are delimited on a connection. Text is the compatibility
+// mode: each command ends with a newline or a NUL and responses are written
+// as-is. LengthPrefixed puts a 4-byte big-endian payload length before
+// every message in both directions. Binary uses the same length prefix but
+// the payloads are the fixed-layout messages from protocol.h.
+enum class FrameMode
+{
+    Text,
+    LengthPrefixed,
+    Binary
+};
+
+enum class FrameStatus
+{
+    Complete,   // A whole frame was removed from the buffer
+    Incomplete, // Wait for more bytes
+    Invalid     // Frame larger than MAX_FRAME_SIZE; drop the connection
+};
+
+// Growable byte buffer with separate read and write positions, so consuming
+// from the front does not move the remaining bytes on every call
+class ByteBuffer
+{
+public:
+    const char *data() const { return buf.data() + readPos; }
+    size_t size() const { return writePos - readPos; }
+    bool empty() const { return readPos == writePos; }
+
+    void append(const char *bytes, size_t len);
+
+    // Returns room for at least len bytes at the end; commit() what was used
+    char *prepare(size_t len);
+    void commit(size_t len) { writePos += len; }
+
+    void consume(size_t len);
+
+private:
+    std::vector<char> buf;
+    size_t readPos = 0;
+    size_t writePos = 0;
+};
+
+// Responses waiting for a socket, kept as separate segments so a whole
+// batch goes out in one writev()/sendmsg() without first being copied into
+// one contiguous buffer
+class OutputQueue
+{
+public:
+    bool empty() const { return segments.empty(); }
+    size_t size() const { return bytes; }
+
+    void push(std::string &&segment);
+
+    // Points up to maxIov iovecs at the unsent bytes; returns how many
+    int gather(struct iovec *iov, int maxIov) const;
+
+    // Drops len bytes from the front after a (possibly short) write
+    void consume(size_t len);
+    void swap(OutputQueue &other);
+
+private:
+    std::deque<std::string> segments;
+    size_t frontOffset = 0; // Bytes of segments.front() already written
+    size_t bytes = 0;
+};
+
+// Removes the next complete frame from in and stores its payload in frame
+FrameStatus decodeFrame(ByteBuffer &in, FrameMode mode, std::string &frame);
+
+// Queues payload on out framed for mode, taking ownership of its bytes
+void encodeFrame(OutputQueue &out, FrameMode mode, std::string payload);
+
+// Recognises "FRAMING TEXT" / "FRAMING LENGTH" / "FRAMING BINARY". Binary is
+// one way: once switched, frames are binary messages and are not checked for
+// further FRAMING requests. Returns false if command is
+// not a framing request; otherwise sets valid and, when valid, mode.
+bool parseFramingRequest(const std::string &command, FrameMode &mode, bool &valid);
+
+#endif
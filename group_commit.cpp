@@ -0,0 +1,145 @@
+#include <iostream>
+#include "group_commit.h"
+#include "account_cache.h"
+#include "database.h"
+#include "db_pool.h"
+#include "sequencer.h"
+#include "symbol_table.h"
+
+// Write-through: balances go straight into the group's open transaction
+class ConnectionSink : public BalanceSink
+{
+public:
+    ConnectionSink(DbConnection &conn, const SymbolTable &symbols) : conn(conn), symbols(symbols) {}
+
+    bool addCash(int user_id, int64_t delta_cents) override
+    {
+        return addUserCash(conn, user_id, delta_cents);
+    }
+
+    bool writePosition(int user_id, uint32_t symbol, int64_t micros) override
+    {
+        return writeUserPosition(conn, symbols.symbol(symbol), symbols.name(symbol), user_id, micros);
+    }
+
+private:
+    DbConnection &conn;
+    const SymbolTable &symbols;
+};
+
+GroupCommitter::GroupCommitter(DbPool &db, AccountCache &accounts, const SymbolTable &symbols, TradeEngine &engine,
+                               Sequencer &sequencer, size_t maxBatch, uint64_t windowUs)
+    : db(db), accounts(accounts), symbols(symbols), engine(engine), sequencer(sequencer), maxBatch(maxBatch > 0 ? maxBatch : 1),
+      windowUs(windowUs)
+{
+}
+
+GroupCommitter::~GroupCommitter()
+{
+    stop();
+}
+
+void GroupCommitter::start()
+{
+    // Each batch the engine thread takes off the ring is one group
+    sequencer.start([this](std::vector<Trade *> &group)
+                    { commitGroup(group); },
+                    maxBatch, windowUs);
+    std::cout << "Group commit: up to " << maxBatch << " trade(s) per transaction, "
+              << windowUs << "us window" << std::endl;
+}
+
+void GroupCommitter::stop()
+{
+    sequencer.stop();
+}
+
+bool GroupCommitter::execute(Trade &trade)
+{
+    return sequencer.submit(trade);
+}
+
+void GroupCommitter::commitGroup(std::vector<Trade *> &group)
+{
+    DbLease lease(db, DbRole::Writer);
+    bool ok = lease.ok();
+    DbConnection &conn = lease.connection();
+    AccountBatch batch(accounts);
+    ConnectionSink sink(conn, symbols);
+
+    // IMMEDIATE takes the write lock now, so no trade can fail halfway
+    // because another connection started writing first
+    if (ok && conn.statements.exec(conn.db, "BEGIN IMMEDIATE;") != SQLITE_OK)
+    {
+        std::cerr << "Failed to begin trade group: " << sqlite3_errmsg(conn.db) << std::endl;
+        ok = false;
+    }
+
+    for (Trade *member : group)
+    {
+        Trade &trade = *member;
+        trade.ok = false;
+        if (!ok)
+        {
+            continue;
+        }
+
+        if (conn.statements.exec(conn.db, "SAVEPOINT trade;") != SQLITE_OK)
+        {
+            std::cerr << "Failed to open trade savepoint: " << sqlite3_errmsg(conn.db) << std::endl;
+            continue;
+        }
+        trade.ok = engine.run(trade, batch, sink);
+        if (!trade.ok)
+        {
+            // Undo whatever part of this trade ran; earlier ones stay. Its
+            // cache changes are only staged once all its writes succeeded.
+            conn.statements.exec(conn.db, "ROLLBACK TO trade;");
+        }
+        conn.statements.exec(conn.db, "RELEASE trade;");
+    }
+
+    if (ok && conn.statements.exec(conn.db, "COMMIT;") != SQLITE_OK)
+    {
+        std::cerr << "Failed to commit trade group: " << sqlite3_errmsg(conn.db) << std::endl;
+        conn.statements.exec(conn.db, "ROLLBACK;");
+        engine.rolledBack();
+        ok = false;
+    }
+
+    // Readers see the new balances only once they are on disk
+    if (ok)
+    {
+        batch.publish();
+    }
+    else
+    {
+        batch.discard();
+    }
+
+    // Nothing is acknowledged unless the whole group made it to disk
+    for (Trade *member : group)
+    {
+        Trade &trade = *member;
+        if (!ok)
+        {
+            trade.ok = false;
+        }
+        if (!trade.ok)
+        {
+            trade.usd_cents = 0;
+            trade.position_micros = 0;
+        }
+    }
+
+    groupCount.fetch_add(1, std::memory_order_relaxed);
+    tradeCount.fetch_add(group.size(), std::memory_order_relaxed);
+}
+
+void GroupCommitter::report(std::ostream &out) const
+{
+    out << "Persistence: write-through\n"
+        << "Group commit: " << trades() << " trade(s) in " << groups() << " transaction(s)\n";
+    sequencer.report(out);
+    engine.report(out);
+}
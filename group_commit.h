@@ -0,0 +1,58 @@
+#ifndef GROUP_COMMIT_H
+#define GROUP_COMMIT_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "trade.h"
+
+class DbPool;
+class AccountCache;
+
+class Sequencer;
+class SymbolTable;
+
+// Gathers trades from all worker threads into shared transactions so one
+// fsync covers many of them. Trades arrive through the Sequencer, whose
+// engine thread hands over whatever is queued (up to maxBatch, optionally
+// waiting windowUs for more); each trade runs in its own savepoint so a
+// rejected one leaves the others intact, the group commits once, and only
+// then are the waiting workers answered. While it commits, the next group
+// builds up, so under load groups grow by themselves. The group's balance
+// changes reach the account cache only after its commit.
+// This is the write-through persistence mode.
+class GroupCommitter : public TradeExecutor
+{
+public:
+    GroupCommitter(DbPool &db, AccountCache &accounts, const SymbolTable &symbols, TradeEngine &engine,
+                   Sequencer &sequencer, size_t maxBatch, uint64_t windowUs);
+    ~GroupCommitter();
+
+    void start() override;
+    void stop() override; // Commits whatever is still queued first
+
+    // Blocks until the trade is durably committed or rejected; returns trade.ok
+    bool execute(Trade &trade) override;
+
+    void report(std::ostream &out) const override;
+
+    uint64_t groups() const { return groupCount.load(std::memory_order_relaxed); }
+    uint64_t trades() const { return tradeCount.load(std::memory_order_relaxed); }
+
+private:
+    void commitGroup(std::vector<Trade *> &group); // On the sequencer's engine thread
+
+    DbPool &db;
+    AccountCache &accounts;
+    const SymbolTable &symbols;
+    TradeEngine &engine;
+    Sequencer &sequencer;
+    size_t maxBatch;
+    uint64_t windowUs;
+
+    std::atomic<uint64_t> groupCount{0};
+    std::atomic<uint64_t> tradeCount{0};
+};
+
+#endif
@@ -0,0 +1,97 @@
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include "listener.h"
+
+int openTcpListener(uint16_t port, int backlog, bool reusePort)
+{
+    struct sockaddr_in sin;
+    int s;
+
+    // Build address data structure
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = INADDR_ANY;
+    sin.sin_port = htons(port);
+
+    // Setup passive open
+    if ((s = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+    {
+        perror("Socket creation failed");
+        return -1;
+    }
+
+    // Allow a restarted server to bind while old connections sit in TIME_WAIT
+    int one = 1;
+    if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0)
+    {
+        perror("SO_REUSEADDR failed");
+        close(s);
+        return -1;
+    }
+
+    if (reusePort && setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0)
+    {
+        perror("SO_REUSEPORT failed");
+        close(s);
+        return -1;
+    }
+
+    if (bind(s, (struct sockaddr *)&sin, sizeof(sin)) < 0)
+    {
+        perror("Bind failed");
+        close(s);
+        return -1;
+    }
+
+    if (listen(s, backlog) < 0)
+    {
+        perror("Listen failed");
+        close(s);
+        return -1;
+    }
+
+    return s;
+}
+
+int openUnixListener(const std::string &path, int backlog)
+{
+    struct sockaddr_un sun;
+    int s;
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(sun.sun_path))
+    {
+        fprintf(stderr, "Unix socket path too long: %s\n", path.c_str());
+        return -1;
+    }
+    memcpy(sun.sun_path, path.c_str(), path.size() + 1);
+
+    if ((s = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+    {
+        perror("Unix socket creation failed");
+        return -1;
+    }
+
+    unlink(path.c_str());
+    if (bind(s, (struct sockaddr *)&sun, sizeof(sun)) < 0)
+    {
+        perror("Unix socket bind failed");
+        close(s);
+        return -1;
+    }
+
+    if (listen(s, backlog) < 0)
+    {
+        perror("Unix socket listen failed");
+        close(s);
+        unlink(path.c_str());
+        return -1;
+    }
+
+    return s;
+}
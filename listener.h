@@ -0,0 +1,18 @@
+#ifndef LISTENER_H
+#define LISTENER_H
+
+#include <cstdint>
+#include <string>
+
+// Opens a non-blocking TCP listening socket on every interface. With
+// reusePort set, several sockets can bind the same port (SO_REUSEPORT) and
+// the kernel spreads incoming connections across them.
+// Returns the socket, or -1 after printing the error.
+int openTcpListener(uint16_t port, int backlog, bool reusePort);
+
+// Opens a non-blocking Unix domain stream socket at path for clients on the
+// same host, replacing a stale socket file left by an earlier run.
+// Returns the socket, or -1 after printing the error.
+int openUnixListener(const std::string &path, int backlog);
+
+#endif
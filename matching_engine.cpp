@@ -0,0 +1,371 @@
+#include <iostream>
+#include "matching_engine.h"
+#include "account_cache.h"
+#include "database.h"
+#include "fixed_point.h"
+
+bool DirectEngine::run(Trade &trade, AccountBatch &accounts, BalanceSink &sink)
+{
+    if (trade.action != OrderAction::New)
+    {
+        std::cerr << "Nothing rests to cancel or replace without the order book engine" << std::endl;
+        return false;
+    }
+    return trade.buy ? buyStock(trade.symbol_id, trade.symbol, trade.amount_micros, trade.price_cents, trade.user_id,
+                                accounts, sink, trade.usd_cents, trade.position_micros)
+                     : sellStock(trade.symbol_id, trade.symbol, trade.amount_micros, trade.price_cents, trade.user_id,
+                                 accounts, sink, trade.usd_cents, trade.position_micros);
+}
+
+void DirectEngine::report(std::ostream &out) const
+{
+    out << "Engine: direct\n";
+}
+
+int64_t BookEngine::heldShares(uint64_t position) const
+{
+    auto it = shareHolds.find(position);
+    return it == shareHolds.end() ? 0 : it->second;
+}
+
+void BookEngine::holdCash(int user_id, int64_t cents)
+{
+    int64_t &held = cashHolds[user_id];
+    held += cents;
+    if (held == 0)
+    {
+        cashHolds.erase(user_id);
+    }
+}
+
+void BookEngine::holdShares(uint64_t position, int64_t micros)
+{
+    int64_t &held = shareHolds[position];
+    held += micros;
+    if (held == 0)
+    {
+        shareHolds.erase(position);
+    }
+}
+
+bool BookEngine::run(Trade &trade, AccountBatch &accounts, BalanceSink &sink)
+{
+    if (trade.action == OrderAction::New)
+    {
+        return place(trade, accounts, sink);
+    }
+
+    OrderBook &book = books[trade.symbol_id];
+    OrderBook::Resting order;
+    if (!book.find(trade.target_id, order) || order.user != trade.user_id)
+    {
+        std::cerr << "Order " << trade.target_id << " is not open on " << trade.symbol << " for user "
+                  << trade.user_id << std::endl;
+        return false;
+    }
+    trade.buy = order.side == Side::Buy;
+
+    // Lowering the quantity at the same price keeps the order's place in
+    // the queue; anything else is a cancel followed by a new order
+    if (trade.action == OrderAction::Replace && trade.price_cents == order.price &&
+        trade.amount_micros > 0 && trade.amount_micros <= order.quantity)
+    {
+        int64_t hold = trade.amount_micros;
+        if (trade.buy)
+        {
+            int64_t value_cents;
+            tradeValueCents(trade.amount_micros, order.price, value_cents, Rounding::Up); // No more than the order's value
+            hold = value_cents < order.hold ? value_cents : order.hold;
+        }
+        book.reduce(trade.target_id, trade.amount_micros, hold);
+        unhold(trade, order.hold - hold, order.quantity - trade.amount_micros, accounts);
+
+        trade.order_id = trade.target_id;
+        trade.resting_micros = trade.amount_micros;
+        accounts.cash(trade.user_id, trade.usd_cents);
+        trade.position_micros = accounts.position(trade.user_id, trade.symbol_id);
+        replaceCount.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    if (trade.action == OrderAction::Replace)
+    {
+        // The old order only goes once the new one has passed its checks
+        if (!place(trade, accounts, sink, &order))
+        {
+            std::cerr << "Replacement for order " << trade.target_id << " rejected; the order is unchanged"
+                      << std::endl;
+            return false;
+        }
+        replaceCount.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool wasEmpty = book.empty();
+    book.cancel(trade.target_id);
+    unhold(trade, order.hold, order.quantity, accounts);
+    restingCount.fetch_sub(1, std::memory_order_relaxed);
+    if (book.empty() && !wasEmpty)
+    {
+        bookCount.fetch_sub(1, std::memory_order_relaxed);
+    }
+    trade.order_id = trade.target_id;
+    accounts.cash(trade.user_id, trade.usd_cents);
+    trade.position_micros = accounts.position(trade.user_id, trade.symbol_id);
+    cancelCount.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+// Frees what a resting order of trade's user no longer needs: cents of a
+// bid's reservation, or micro-shares of an ask
+void BookEngine::unhold(const Trade &trade, int64_t cents, int64_t micros, AccountBatch &accounts)
+{
+    if (trade.buy)
+    {
+        accounts.releaseCash(trade.user_id, cents);
+        holdCash(trade.user_id, -cents);
+    }
+    else
+    {
+        holdShares(balanceKey(trade.user_id, trade.symbol_id), -micros);
+    }
+}
+
+// What a taker bid's fills cost it. Each fill pays the rise in the total
+// so far rounded up, so together they cost their exact value rounded up
+// once: never more than the bid's hold, which is its value at a limit no
+// fill is above.
+class FillCost
+{
+public:
+    int64_t add(int64_t quantity, int64_t price)
+    {
+        int64_t before = total();
+        exact += (unsigned __int128)quantity * (uint64_t)price;
+        return total() - before;
+    }
+
+private:
+    int64_t total() const { return (int64_t)((exact + MICROS_PER_SHARE - 1) / MICROS_PER_SHARE); }
+
+    unsigned __int128 exact = 0; // Cents * micro-shares
+};
+
+bool BookEngine::place(Trade &trade, AccountBatch &accounts, BalanceSink &sink, const OrderBook::Resting *replacing)
+{
+    Side side = trade.buy ? Side::Buy : Side::Sell;
+    uint64_t own = balanceKey(trade.user_id, trade.symbol_id);
+
+    int64_t usd_cents;
+    if (!accounts.cash(trade.user_id, usd_cents))
+    {
+        std::cerr << "User ID " << trade.user_id << " does not exist!" << std::endl;
+        return false;
+    }
+    int64_t orderHold = 0;
+    if (!tradeValueCents(trade.amount_micros, trade.price_cents, orderHold, Rounding::Up))
+    {
+        std::cerr << "Trade value out of range for user " << trade.user_id << std::endl;
+        return false;
+    }
+
+    // Only shares not already held by the user's resting asks are free. A
+    // bid reserves its whole value at its limit up front (see AccountCache),
+    // which fails if other bids, here or on other shards, already reserved it.
+    // An order being replaced counts as free, and a replaced bid's hold
+    // carries over rather than being released and reserved again.
+    int64_t carried = replacing ? (trade.buy ? replacing->hold : replacing->quantity) : 0;
+    int64_t extra = trade.buy ? orderHold - carried : 0; // Beyond the carried hold; may be negative
+    if (!trade.buy &&
+        accounts.position(trade.user_id, trade.symbol_id) - heldShares(own) + carried < trade.amount_micros)
+    {
+        std::cerr << "Insufficient free " << trade.symbol << " balance for user " << trade.user_id
+                  << " to sell " << formatMicros(trade.amount_micros) << std::endl;
+        return false;
+    }
+    if (extra > 0 && !accounts.reserveCash(trade.user_id, extra))
+    {
+        std::cerr << "User does not have enough free funds! Balance: $ " << formatCents(usd_cents)
+                  << ", free: " << formatCents(cache.freeCash(trade.user_id))
+                  << ", required: " << formatCents(extra) << std::endl;
+        return false;
+    }
+
+    // Work out every balance the fills move before touching the book, so a
+    // failed write leaves the book as it was
+    OrderBook &book = books[trade.symbol_id];
+    bool wasEmpty = book.empty();
+    fills.clear();
+    book.preview(side, trade.price_cents, trade.amount_micros, fills);
+
+    cashChanges.clear();
+    positions.clear();
+    auto position = [&](int user_id) -> int64_t &
+    {
+        auto it = positions.find(user_id);
+        if (it == positions.end())
+        {
+            it = positions.emplace(user_id, accounts.position(user_id, trade.symbol_id)).first;
+        }
+        return it->second;
+    };
+    position(trade.user_id);
+
+    // Whichever side is the bid pays each fill out of its hold: a taker
+    // through FillCost, a maker with what the fill releases
+    FillCost cost;
+    int64_t takerSpent = 0;
+    int64_t filled = 0;
+    for (const Fill &fill : fills)
+    {
+        int64_t value_cents = trade.buy ? cost.add(fill.quantity, fill.price) : fill.released;
+        if (trade.buy)
+        {
+            takerSpent += value_cents;
+        }
+        filled += fill.quantity;
+        int buyer = trade.buy ? trade.user_id : fill.makerUser;
+        int seller = trade.buy ? fill.makerUser : trade.user_id;
+        cashChanges[buyer] -= value_cents;
+        position(buyer) += fill.quantity;
+        position(seller) -= fill.quantity;
+        cashChanges[seller] += value_cents;
+    }
+
+    bool written = true;
+    for (auto it = cashChanges.begin(); written && it != cashChanges.end(); ++it)
+    {
+        written = it->second == 0 || sink.addCash(it->first, it->second);
+    }
+    for (auto it = positions.begin(); written && it != positions.end(); ++it)
+    {
+        written = sink.writePosition(it->first, trade.symbol_id, it->second);
+    }
+    if (!written)
+    {
+        if (extra > 0)
+        {
+            accounts.releaseCash(trade.user_id, extra);
+        }
+        return false;
+    }
+
+    // What rests of a bid keeps its value at the limit, out of whatever
+    // its fills left of the reservation
+    int64_t takerHold = 0;
+    if (trade.buy && filled < trade.amount_micros)
+    {
+        tradeValueCents(trade.amount_micros - filled, trade.price_cents, takerHold, Rounding::Up);
+        if (takerHold > orderHold - takerSpent)
+        {
+            takerHold = orderHold - takerSpent;
+        }
+    }
+
+    // Now trade for real. The replaced order is on the same side, so it
+    // took no part in the preview and the fills stay the same without it.
+    size_t restingBefore = book.orders();
+    if (replacing)
+    {
+        book.cancel(trade.target_id);
+        if (trade.buy)
+        {
+            holdCash(trade.user_id, -replacing->hold);
+        }
+        else
+        {
+            holdShares(own, -replacing->quantity);
+        }
+    }
+    uint64_t id = nextOrderId;
+    nextOrderId += orderIdStep;
+    fills.clear();
+    int64_t resting = book.submit(id, trade.user_id, side, trade.price_cents, trade.amount_micros, takerHold, fills);
+
+    // Each fill is paid out of the buyer's reservation, at the same
+    // values as above
+    cost = FillCost();
+    for (const Fill &fill : fills)
+    {
+        if (trade.buy)
+        {
+            int64_t value_cents = cost.add(fill.quantity, fill.price);
+            accounts.spendCash(trade.user_id, value_cents);
+            accounts.creditCash(fill.makerUser, value_cents);
+            holdShares(balanceKey(fill.makerUser, trade.symbol_id), -fill.released);
+        }
+        else
+        {
+            accounts.spendCash(fill.makerUser, fill.released);
+            accounts.creditCash(trade.user_id, fill.released);
+            holdCash(fill.makerUser, -fill.released);
+        }
+    }
+
+    // The rest of this order is held while it rests; a bid frees whatever
+    // of its reservation neither its fills nor its hold use
+    if (trade.buy)
+    {
+        int64_t kept = resting > 0 ? takerHold : 0;
+        accounts.releaseCash(trade.user_id, orderHold - takerSpent - kept + (extra < 0 ? -extra : 0));
+        if (kept > 0)
+        {
+            holdCash(trade.user_id, kept);
+        }
+    }
+    else if (resting > 0)
+    {
+        holdShares(own, resting);
+    }
+    for (auto &entry : positions)
+    {
+        accounts.setPosition(entry.first, trade.symbol_id, entry.second);
+    }
+
+    trade.order_id = id;
+    trade.filled_micros = trade.amount_micros - resting;
+    trade.resting_micros = resting;
+    accounts.cash(trade.user_id, trade.usd_cents);
+    trade.position_micros = positions[trade.user_id];
+
+    orderCount.fetch_add(1, std::memory_order_relaxed);
+    fillCount.fetch_add(fills.size(), std::memory_order_relaxed);
+    restingCount.fetch_add((uint64_t)((int64_t)book.orders() - (int64_t)restingBefore), std::memory_order_relaxed);
+    if (wasEmpty != book.empty())
+    {
+        bookCount.fetch_add(wasEmpty ? 1 : (uint64_t)-1, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+void BookEngine::rolledBack()
+{
+    // Balances went back to what is on disk, so the books and holds built
+    // on top of them cannot be trusted; cancel everything and free the
+    // cash the bids had reserved
+    std::cerr << "Trades rolled back: cancelling " << restingCount.load(std::memory_order_relaxed)
+              << " resting order(s)" << std::endl;
+    for (auto &held : cashHolds)
+    {
+        cache.releaseCash(held.first, held.second);
+    }
+    for (OrderBook &book : books)
+    {
+        book = OrderBook();
+    }
+    cashHolds.clear();
+    shareHolds.clear();
+    restingCount.store(0, std::memory_order_relaxed);
+    bookCount.store(0, std::memory_order_relaxed);
+}
+
+void BookEngine::report(std::ostream &out) const
+{
+    out << "Engine: book\n"
+        << "Orders: " << orderCount.load(std::memory_order_relaxed)
+        << ", fills: " << fillCount.load(std::memory_order_relaxed)
+        << ", resting: " << restingCount.load(std::memory_order_relaxed)
+        << " in " << bookCount.load(std::memory_order_relaxed) << " book(s), cancels: "
+        << cancelCount.load(std::memory_order_relaxed) << ", replaces: "
+        << replaceCount.load(std::memory_order_relaxed) << "\n";
+}
@@ -0,0 +1,83 @@
+#ifndef MATCHING_ENGINE_H
+#define MATCHING_ENGINE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include "order_book.h"
+#include "trade.h"
+
+class AccountCache;
+
+// The original behaviour: BUY and SELL settle against the house at the
+// price the client names
+class DirectEngine : public TradeEngine
+{
+public:
+    bool run(Trade &trade, AccountBatch &accounts, BalanceSink &sink) override;
+    void report(std::ostream &out) const override;
+};
+
+// BUY and SELL are limit orders on a per-symbol OrderBook. An order first
+// trades with resting orders on the other side at their prices, best price
+// and then oldest first; whatever is left rests at its limit. Every fill
+// settles cash and shares between the two users straight away.
+//
+// A resting order's funds are held so they cannot be spent twice: a bid
+// keeps its value at its limit reserved in the account cache, an ask holds
+// its shares here. Holds only live in memory and never change the stored
+// balances, so losing the books (restart, failed commit) cancels the
+// orders without losing any money.
+//
+// CANCEL takes a resting order off its book and frees its hold. REPLACE
+// that only lowers the quantity at the same price shrinks the order and
+// its hold in place, so it keeps its place in the queue; any other
+// replace cancels the order and places a new one under a new ID, which
+// may trade at once. The new order is checked, and its funds reserved,
+// before the old one goes, so a rejected replace changes nothing. Only
+// the new order's fills touch the stored balances.
+//
+// Order IDs are unique across shards: shard i of n hands out i+1, i+1+n,
+// i+1+2n and so on.
+class BookEngine : public TradeEngine
+{
+public:
+    BookEngine(AccountCache &cache, size_t symbolCount, size_t shard = 0, size_t shards = 1)
+        : cache(cache), books(symbolCount), nextOrderId(shard + 1), orderIdStep(shards) {}
+
+    bool run(Trade &trade, AccountBatch &accounts, BalanceSink &sink) override;
+    void rolledBack() override;
+    void report(std::ostream &out) const override;
+
+private:
+    // A new order, taking the place of replacing if given
+    bool place(Trade &trade, AccountBatch &accounts, BalanceSink &sink,
+               const OrderBook::Resting *replacing = nullptr);
+    void unhold(const Trade &trade, int64_t cents, int64_t micros, AccountBatch &accounts);
+    int64_t heldShares(uint64_t position) const; // By balanceKey()
+    void holdCash(int user_id, int64_t cents);
+    void holdShares(uint64_t position, int64_t micros);
+
+    AccountCache &cache;
+    std::vector<OrderBook> books;                // Indexed by symbol ID; only this shard's are used
+    std::unordered_map<int, int64_t> cashHolds; // Reserved in cache for resting bids
+    std::unordered_map<uint64_t, int64_t> shareHolds;
+    uint64_t nextOrderId;
+    uint64_t orderIdStep;
+    std::vector<Fill> fills;             // Reused by every order
+    std::map<int, int64_t> cashChanges;  // ...as are the balances it moves, by user
+    std::map<int, int64_t> positions;
+
+    // Read by STATS while trades run
+    std::atomic<uint64_t> orderCount{0};
+    std::atomic<uint64_t> fillCount{0};
+    std::atomic<uint64_t> restingCount{0};
+    std::atomic<uint64_t> bookCount{0}; // Books with resting orders
+    std::atomic<uint64_t> cancelCount{0};
+    std::atomic<uint64_t> replaceCount{0};
+};
+
+#endif
@@ -0,0 +1,289 @@
+#include <algorithm>
+#include "order_book.h"
+#include "fixed_point.h"
+
+int64_t OrderBook::holdRelease(int64_t price, int64_t open, int64_t hold)
+{
+    int64_t kept;
+    if (!tradeValueCents(open, price, kept, Rounding::Up) || kept > hold)
+    {
+        return 0; // Already holds less than what stays open is worth
+    }
+    return hold - kept;
+}
+
+int64_t OrderBook::submit(uint64_t id, int32_t user, Side side, int64_t price, int64_t quantity, int64_t hold,
+                          std::vector<Fill> &fills)
+{
+    // A buy takes asks priced at or below its limit, a sell bids at or above
+    bool buy = side == Side::Buy;
+    std::vector<Level> &levels = buy ? asks : bids;
+    while (quantity > 0 && !levels.empty() && (buy ? levels.back().price <= price : levels.back().price >= price))
+    {
+        Level &level = levels.back();
+        while (quantity > 0 && level.head != NIL)
+        {
+            uint32_t slot = level.head;
+            Order &maker = pool[slot];
+            int64_t traded = maker.quantity < quantity ? maker.quantity : quantity;
+            maker.quantity -= traded;
+            quantity -= traded;
+
+            bool done = maker.quantity == 0;
+            int64_t released = traded; // A resting sell holds its shares
+            if (!buy)
+            {
+                released = holdRelease(level.price, maker.quantity, maker.hold);
+                maker.hold -= released;
+            }
+            fills.push_back(Fill{maker.id, maker.user, level.price, traded, released, done});
+
+            if (done)
+            {
+                level.head = maker.next;
+                if (level.head != NIL)
+                {
+                    pool[level.head].prev = NIL;
+                }
+                release(slot);
+            }
+        }
+        if (level.head == NIL)
+        {
+            levels.pop_back();
+        }
+    }
+
+    if (quantity > 0)
+    {
+        rest(id, user, side, price, quantity, hold);
+    }
+    return quantity;
+}
+
+void OrderBook::preview(Side side, int64_t price, int64_t quantity, std::vector<Fill> &fills) const
+{
+    bool buy = side == Side::Buy;
+    const std::vector<Level> &levels = buy ? asks : bids;
+    for (size_t i = levels.size(); quantity > 0 && i > 0; i--)
+    {
+        const Level &level = levels[i - 1];
+        if (buy ? level.price > price : level.price < price)
+        {
+            break;
+        }
+        for (uint32_t slot = level.head; quantity > 0 && slot != NIL; slot = pool[slot].next)
+        {
+            const Order &maker = pool[slot];
+            int64_t traded = maker.quantity < quantity ? maker.quantity : quantity;
+            quantity -= traded;
+
+            bool done = traded == maker.quantity;
+            int64_t released = buy ? traded : holdRelease(level.price, maker.quantity - traded, maker.hold);
+            fills.push_back(Fill{maker.id, maker.user, level.price, traded, released, done});
+        }
+    }
+}
+
+uint32_t OrderBook::allocate()
+{
+    if (freeHead != NIL)
+    {
+        uint32_t slot = freeHead;
+        freeHead = pool[slot].next;
+        return slot;
+    }
+    pool.push_back(Order());
+    return (uint32_t)(pool.size() - 1);
+}
+
+void OrderBook::release(uint32_t slot)
+{
+    indexErase(pool[slot].id);
+    pool[slot].next = freeHead;
+    freeHead = slot;
+    restingCount--;
+}
+
+void OrderBook::rest(uint64_t id, int32_t user, Side side, int64_t price, int64_t quantity, int64_t hold)
+{
+    uint32_t slot = allocate();
+    pool[slot] = Order{id, quantity, hold, price, user, NIL, NIL, side};
+    indexAdd(id, slot);
+    restingCount++;
+
+    // Find the level, or where it goes, keeping the best price at the back
+    std::vector<Level> &levels = side == Side::Buy ? bids : asks;
+    auto byPrice = [side](const Level &level, int64_t p)
+    { return side == Side::Buy ? level.price < p : level.price > p; };
+    auto it = std::lower_bound(levels.begin(), levels.end(), price, byPrice);
+    if (it == levels.end() || it->price != price)
+    {
+        levels.insert(it, Level{price, slot, slot});
+        return;
+    }
+    pool[it->tail].next = slot;
+    pool[slot].prev = it->tail;
+    it->tail = slot;
+}
+
+bool OrderBook::find(uint64_t id, Resting &out) const
+{
+    size_t i = indexSlotFor(id);
+    if (i == index.size() || index[i].id == 0)
+    {
+        return false;
+    }
+    const Order &order = pool[index[i].slot];
+    out = Resting{order.user, order.side, order.price, order.quantity, order.hold};
+    return true;
+}
+
+bool OrderBook::cancel(uint64_t id)
+{
+    size_t i = indexSlotFor(id);
+    if (i == index.size() || index[i].id == 0)
+    {
+        return false;
+    }
+    uint32_t slot = index[i].slot;
+    Order &order = pool[slot];
+
+    // Neighbours first; the level itself only matters when this order is
+    // at one of its ends
+    if (order.prev != NIL)
+    {
+        pool[order.prev].next = order.next;
+    }
+    if (order.next != NIL)
+    {
+        pool[order.next].prev = order.prev;
+    }
+    if (order.prev == NIL || order.next == NIL)
+    {
+        std::vector<Level> &levels = order.side == Side::Buy ? bids : asks;
+        Side side = order.side;
+        auto byPrice = [side](const Level &level, int64_t p)
+        { return side == Side::Buy ? level.price < p : level.price > p; };
+        auto it = std::lower_bound(levels.begin(), levels.end(), order.price, byPrice);
+        if (order.prev == NIL)
+        {
+            it->head = order.next;
+        }
+        if (order.next == NIL)
+        {
+            it->tail = order.prev;
+        }
+        if (it->head == NIL)
+        {
+            levels.erase(it); // Shifts only the better levels, usually few
+        }
+    }
+    release(slot);
+    return true;
+}
+
+bool OrderBook::reduce(uint64_t id, int64_t quantity, int64_t hold)
+{
+    size_t i = indexSlotFor(id);
+    if (i == index.size() || index[i].id == 0)
+    {
+        return false;
+    }
+    Order &order = pool[index[i].slot];
+    if (quantity <= 0 || quantity > order.quantity || hold > order.hold)
+    {
+        return false;
+    }
+    order.quantity = quantity;
+    order.hold = hold;
+    return true;
+}
+
+// Order IDs are handed out in sequence (strided across shards), so their
+// low bits alone spread them, and orders placed close together sit in
+// neighbouring slots
+size_t OrderBook::homeOf(uint64_t id, size_t mask)
+{
+    return (size_t)id & mask;
+}
+
+// The slot holding id, or the free slot that ends its probe run;
+// index.size() while the index is empty
+size_t OrderBook::indexSlotFor(uint64_t id) const
+{
+    if (index.empty())
+    {
+        return 0;
+    }
+    size_t mask = index.size() - 1;
+    size_t i = homeOf(id, mask);
+    while (index[i].id != 0 && index[i].id != id)
+    {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+void OrderBook::indexAdd(uint64_t id, uint32_t slot)
+{
+    if ((indexCount + indexDead + 1) * 2 > index.size())
+    {
+        rebuildIndex();
+    }
+
+    // IDs are never reused, so the first free or dead slot will do
+    size_t mask = index.size() - 1;
+    size_t i = homeOf(id, mask);
+    while (index[i].id != 0 && index[i].id != INDEX_DEAD)
+    {
+        i = (i + 1) & mask;
+    }
+    if (index[i].id == INDEX_DEAD)
+    {
+        indexDead--;
+    }
+    index[i] = IndexSlot{id, slot};
+    indexCount++;
+}
+
+void OrderBook::indexErase(uint64_t id)
+{
+    size_t i = indexSlotFor(id);
+    if (i == index.size() || index[i].id == 0)
+    {
+        return;
+    }
+    // Left as a marker rather than closing the gap: runs of consecutive
+    // IDs can be long, and closing it would walk to the end of the run
+    index[i].id = INDEX_DEAD;
+    indexCount--;
+    indexDead++;
+}
+
+// Drops the dead slots, growing until live orders fill at most a quarter
+void OrderBook::rebuildIndex()
+{
+    size_t size = index.empty() ? 64 : index.size();
+    while ((indexCount + 1) * 4 > size)
+    {
+        size *= 2;
+    }
+    std::vector<IndexSlot> old(size);
+    old.swap(index);
+    indexDead = 0;
+    size_t mask = index.size() - 1;
+    for (const IndexSlot &entry : old)
+    {
+        if (entry.id == 0 || entry.id == INDEX_DEAD)
+        {
+            continue;
+        }
+        size_t i = homeOf(entry.id, mask);
+        while (index[i].id != 0)
+        {
+            i = (i + 1) & mask;
+        }
+        index[i] = entry;
+    }
+}
@@ -0,0 +1,133 @@
+#ifndef ORDER_BOOK_H
+#define ORDER_BOOK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+enum class Side : uint8_t
+{
+    Buy,
+    Sell
+};
+
+// One execution between a resting (maker) order and an incoming one
+struct Fill
+{
+    uint64_t makerId;
+    int32_t makerUser;
+    int64_t price;    // Cents; always the maker's price
+    int64_t quantity; // Micro-shares
+    int64_t released; // Of the maker's hold: cents for a bid (what it pays), micro-shares for an ask
+    bool makerDone;   // The maker order is used up
+};
+
+// Limit order book of one symbol with price-time priority. Each side is a
+// sorted array of price levels with the best price at the back, so the
+// levels that trade are reached and removed without shifting anything.
+// Each level is a FIFO of orders doubly linked by index through one pooled
+// array, whose freed slots are reused, so a busy book does not allocate.
+// An open-addressed index from order ID to slot (linear probing, at most
+// half full counting the slots of removed orders) lets an order be
+// cancelled or reduced without a search: it is unlinked from its level in
+// place, and only a level it leaves empty is looked up by price.
+// Prices are cents and quantities micro-shares (see fixed_point.h).
+//
+// A resting bid carries a hold: the cash its owner set aside to pay for it.
+// Each fill against it is paid out of the hold, with everything above the
+// value of what stays open (see holdRelease()), so together a bid's fills
+// cost exactly its hold and never more. An ask holds exactly its open
+// shares, so its fills free what they trade.
+class OrderBook
+{
+public:
+    // Matches an incoming limit order against the other side, appending its
+    // fills in execution order, and rests what is left at price under id.
+    // Returns the quantity left resting (0 when it filled completely).
+    int64_t submit(uint64_t id, int32_t user, Side side, int64_t price, int64_t quantity, int64_t hold,
+                   std::vector<Fill> &fills);
+
+    // The fills submit() would produce, without changing the book
+    void preview(Side side, int64_t price, int64_t quantity, std::vector<Fill> &fills) const;
+
+    // A resting order, as find() reports it
+    struct Resting
+    {
+        int32_t user;
+        Side side;
+        int64_t price;
+        int64_t quantity; // Still open
+        int64_t hold;
+    };
+
+    // False if id is not resting on this book
+    bool find(uint64_t id, Resting &out) const;
+
+    // Takes a resting order off the book
+    bool cancel(uint64_t id);
+
+    // Lowers a resting order's open quantity (0 < quantity <= open) and
+    // hold, keeping its place in the queue
+    bool reduce(uint64_t id, int64_t quantity, int64_t hold);
+
+    bool empty() const { return bids.empty() && asks.empty(); }
+    int64_t bestBid() const { return bids.empty() ? 0 : bids.back().price; }
+    int64_t bestAsk() const { return asks.empty() ? 0 : asks.back().price; }
+    size_t orders() const { return restingCount; }
+    size_t levels() const { return bids.size() + asks.size(); }
+
+    // Hold freed by a fill of a bid resting at price with hold left, which
+    // leaves open micro-shares of it open: all of the hold but the value of
+    // those (rounded up), so everything once it is done
+    static int64_t holdRelease(int64_t price, int64_t open, int64_t hold);
+
+private:
+    static const uint32_t NIL = UINT32_MAX;
+    static const uint64_t INDEX_DEAD = UINT64_MAX; // Index slot of a removed order
+
+    struct Order
+    {
+        uint64_t id;
+        int64_t quantity; // Still open
+        int64_t hold;
+        int64_t price;
+        int32_t user;
+        uint32_t next; // Next order at the same level, or the next free slot
+        uint32_t prev; // Previous order at the same level
+        Side side;
+    };
+
+    struct Level
+    {
+        int64_t price;
+        uint32_t head; // Oldest order, filled first
+        uint32_t tail;
+    };
+
+    struct IndexSlot
+    {
+        uint64_t id = 0; // 0 marks a free slot; order IDs start at 1
+        uint32_t slot = NIL;
+    };
+
+    uint32_t allocate();
+    void release(uint32_t slot); // Back to the free list, out of the index
+    void rest(uint64_t id, int32_t user, Side side, int64_t price, int64_t quantity, int64_t hold);
+
+    static size_t homeOf(uint64_t id, size_t mask);
+    size_t indexSlotFor(uint64_t id) const;
+    void indexAdd(uint64_t id, uint32_t slot);
+    void indexErase(uint64_t id);
+    void rebuildIndex();
+
+    std::vector<Level> bids; // Ascending, best (highest) at the back
+    std::vector<Level> asks; // Descending, best (lowest) at the back
+    std::vector<Order> pool;
+    uint32_t freeHead = NIL;
+    std::vector<IndexSlot> index; // Order ID -> pool slot
+    size_t indexCount = 0;
+    size_t indexDead = 0; // INDEX_DEAD slots, reclaimed by rebuildIndex()
+    size_t restingCount = 0;
+};
+
+#endif
@@ -0,0 +1,96 @@
+#include <cstring>
+#include "protocol.h"
+
+// Returns data as a T if it is exactly one, of the current version
+template <typename T>
+static const T *view(const char *data, size_t len)
+{
+    if (len != sizeof(T) || (uint8_t)data[1] != PROTOCOL_VERSION)
+    {
+        return nullptr;
+    }
+    return reinterpret_cast<const T *>(data);
+}
+
+// The bytes of msg with its header filled in
+template <typename T>
+static std::string encode(T msg, uint8_t type, uint16_t status)
+{
+    msg.header.type = type;
+    msg.header.version = PROTOCOL_VERSION;
+    msg.header.status = status;
+    return std::string(reinterpret_cast<const char *>(&msg), sizeof(msg));
+}
+
+const MsgHeader *viewHeader(const char *data, size_t len)
+{
+    if (len < MSG_HEADER_SIZE)
+    {
+        return nullptr;
+    }
+    return reinterpret_cast<const MsgHeader *>(data);
+}
+
+const OrderRequest *viewOrderRequest(const char *data, size_t len)
+{
+    return view<OrderRequest>(data, len);
+}
+
+const BalanceRequest *viewBalanceRequest(const char *data, size_t len)
+{
+    return view<BalanceRequest>(data, len);
+}
+
+const OrderAck *viewOrderAck(const char *data, size_t len)
+{
+    return view<OrderAck>(data, len);
+}
+
+const BalanceReply *viewBalanceReply(const char *data, size_t len)
+{
+    return view<BalanceReply>(data, len);
+}
+
+size_t symbolLength(const char (&symbol)[SYMBOL_LEN])
+{
+    size_t len = 0;
+    while (len < SYMBOL_LEN && symbol[len] != '\0')
+    {
+        len++;
+    }
+    return len;
+}
+
+void setSymbol(char (&symbol)[SYMBOL_LEN], const std::string &text)
+{
+    memset(symbol, 0, SYMBOL_LEN);
+    memcpy(symbol, text.data(), text.size() < SYMBOL_LEN ? text.size() : SYMBOL_LEN);
+}
+
+std::string encodeOrderRequest(uint8_t type, const OrderRequest &request)
+{
+    return encode(request, type, 0);
+}
+
+std::string encodeBalanceRequest(int32_t user_id)
+{
+    BalanceRequest request{};
+    request.user_id = user_id;
+    return encode(request, MSG_BALANCE, 0);
+}
+
+std::string encodeOrderAck(uint16_t status, const OrderAck &ack)
+{
+    return encode(ack, MSG_ORDER_ACK, status);
+}
+
+std::string encodeBalanceReply(uint16_t status, const BalanceReply &reply)
+{
+    return encode(reply, MSG_BALANCE_REPLY, status);
+}
+
+std::string encodeErrorReply(uint16_t status)
+{
+    MsgHeader header{MSG_ERROR, PROTOCOL_VERSION, status};
+    return std::string(reinterpret_cast<const char *>(&header), sizeof(header));
+}
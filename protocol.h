@@ -0,0 +1,137 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Binary order-entry protocol for automated clients, negotiated with
+// "FRAMING BINARY". Every message travels in a length-prefixed frame and
+// starts with a 4-byte header:
+//
+//   [0] type (uint8)  [1] version (uint8)  [2..3] status (uint16, 0 in requests)
+//
+// All multi-byte fields are little-endian. Quantities are int64 millionths
+// of a share and cash amounts int64 cents (see fixed_point.h).
+//
+//   Order request (BUY/SELL), 32 bytes     Order ack, 40 bytes
+//   [4..7]   user_id (int32)               [4..7]   user_id (int32)
+//   [8..15]  symbol, NUL padded            [8..15]  symbol, NUL padded
+//   [16..23] quantity (int64 micros)       [16..23] new position (int64 micros)
+//   [24..31] price per share (int64 cents) [24..31] new USD balance (int64 cents)
+//                                          [32..39] order ID (uint64, 0 if none)
+//
+//   Balance request, 8 bytes               Balance reply, 16 bytes
+//   [4..7]   user_id (int32)               [4..7]   user_id (int32)
+//                                          [8..15]  USD balance (int64 cents)
+//
+//   Error reply, 4 bytes: header only, status says why
+//
+// The ack's order ID is the one the order book engine gave the order, so
+// it can be cancelled or replaced over a text connection.
+//
+// Version 1 carried the same fields as doubles; its messages are now
+// answered with a 400 error reply.
+
+#define PROTOCOL_VERSION 2
+#define SYMBOL_LEN 8
+
+#define MSG_HEADER_SIZE 4
+#define ORDER_MSG_SIZE 32
+#define ORDER_ACK_SIZE 40
+#define BALANCE_REQUEST_SIZE 8
+#define BALANCE_REPLY_SIZE 16
+
+enum MessageType : uint8_t
+{
+    MSG_BUY = 0x01,
+    MSG_SELL = 0x02,
+    MSG_BALANCE = 0x03,
+    MSG_ORDER_ACK = 0x81,
+    MSG_BALANCE_REPLY = 0x83,
+    MSG_ERROR = 0xFF
+};
+
+// Status codes shared with the text protocol's reply lines
+enum StatusCode : uint16_t
+{
+    STATUS_OK = 200,
+    STATUS_BAD_REQUEST = 400,
+    STATUS_NOT_FOUND = 404,
+    STATUS_BUSY = 503,
+    STATUS_TIMEOUT = 504
+};
+
+// The messages exactly as they travel. Received frames are read through
+// these in place rather than copied out field by field, which only works
+// on a little-endian host. Packed so a frame at any address can be viewed.
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "binary messages are viewed in place");
+
+struct __attribute__((packed)) MsgHeader
+{
+    uint8_t type;
+    uint8_t version;
+    uint16_t status; // 0 in requests
+};
+
+struct __attribute__((packed)) OrderRequest
+{
+    MsgHeader header; // type MSG_BUY or MSG_SELL
+    int32_t user_id;
+    char symbol[SYMBOL_LEN];
+    int64_t quantity_micros;
+    int64_t price_cents;
+};
+
+struct __attribute__((packed)) OrderAck
+{
+    MsgHeader header;
+    int32_t user_id;
+    char symbol[SYMBOL_LEN];
+    int64_t position_micros;
+    int64_t usd_cents;
+    uint64_t order_id;
+};
+
+struct __attribute__((packed)) BalanceRequest
+{
+    MsgHeader header;
+    int32_t user_id;
+};
+
+struct __attribute__((packed)) BalanceReply
+{
+    MsgHeader header;
+    int32_t user_id;
+    int64_t usd_cents;
+};
+
+static_assert(sizeof(MsgHeader) == MSG_HEADER_SIZE, "header layout");
+static_assert(sizeof(OrderRequest) == ORDER_MSG_SIZE, "order request layout");
+static_assert(sizeof(OrderAck) == ORDER_ACK_SIZE, "order ack layout");
+static_assert(sizeof(BalanceRequest) == BALANCE_REQUEST_SIZE, "balance request layout");
+static_assert(sizeof(BalanceReply) == BALANCE_REPLY_SIZE, "balance reply layout");
+
+// Views the header; nullptr if the frame is too short for one
+const MsgHeader *viewHeader(const char *data, size_t len);
+
+// View a received frame as its message, without copying. nullptr when the
+// frame has the wrong size or version. The view lives as long as data.
+const OrderRequest *viewOrderRequest(const char *data, size_t len);
+const BalanceRequest *viewBalanceRequest(const char *data, size_t len);
+const OrderAck *viewOrderAck(const char *data, size_t len);
+const BalanceReply *viewBalanceReply(const char *data, size_t len);
+
+// A symbol field's length, up to SYMBOL_LEN, and setting one from text
+// (which must fit)
+size_t symbolLength(const char (&symbol)[SYMBOL_LEN]);
+void setSymbol(char (&symbol)[SYMBOL_LEN], const std::string &text);
+
+// Encoders fill in the header (type, version, status) and return the bytes
+std::string encodeOrderRequest(uint8_t type, const OrderRequest &request);
+std::string encodeBalanceRequest(int32_t user_id);
+std::string encodeOrderAck(uint16_t status, const OrderAck &ack);
+std::string encodeBalanceReply(uint16_t status, const BalanceReply &reply);
+std::string encodeErrorReply(uint16_t status);
+
+#endif
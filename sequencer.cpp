@@ -0,0 +1,393 @@
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <pthread.h>
+#include <sched.h>
+#include "sequencer.h"
+#include "fixed_point.h"
+
+static size_t roundUpPow2(size_t n)
+{
+    size_t size = 1;
+    while (size < n)
+    {
+        size <<= 1;
+    }
+    return size;
+}
+
+void Parker::park(const std::function<bool()> &ready)
+{
+    // Announce the sleep before the last look, so a waker that published
+    // after that look is sure to see it (and the other way round)
+    sleeping.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (ready())
+    {
+        sleeping.store(false, std::memory_order_relaxed);
+        return;
+    }
+    std::unique_lock<std::mutex> lock(mtx);
+    cv.wait(lock, [this]
+            { return !sleeping.load(std::memory_order_relaxed); });
+}
+
+void Parker::wake()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.load(std::memory_order_relaxed))
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        sleeping.store(false, std::memory_order_relaxed);
+        cv.notify_one();
+    }
+}
+
+IngressRing::IngressRing(size_t capacity)
+    : mask(roundUpPow2(capacity > 0 ? capacity : 1) - 1)
+{
+    slots.reset(new Slot[mask + 1]);
+    for (size_t i = 0; i <= mask; i++)
+    {
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+bool IngressRing::push(const Entry &entry)
+{
+    uint64_t position = tail.load(std::memory_order_relaxed);
+    Slot *slot;
+    while (true)
+    {
+        slot = &slots[position & mask];
+        uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+        int64_t diff = (int64_t)(sequence - position);
+        if (diff == 0)
+        {
+            if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            return false; // The consumer has not freed this slot from the last lap
+        }
+        else
+        {
+            position = tail.load(std::memory_order_relaxed); // Someone else claimed it
+        }
+    }
+    slot->entry = entry;
+    slot->sequence.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+bool IngressRing::pop(Entry &entry, uint64_t &position)
+{
+    Slot &slot = slots[head & mask];
+    if (slot.sequence.load(std::memory_order_acquire) != head + 1)
+    {
+        return false; // Not published yet, even if later positions are
+    }
+    entry = slot.entry;
+    position = head;
+    slot.sequence.store(head + mask + 1, std::memory_order_release);
+    head++;
+    return true;
+}
+
+bool IngressRing::ready() const
+{
+    return slots[head & mask].sequence.load(std::memory_order_acquire) == head + 1;
+}
+
+ResultRing::ResultRing(size_t capacity)
+    : mask(roundUpPow2(capacity > 0 ? capacity : 1) - 1)
+{
+    slots.reset(new Trade *[mask + 1]);
+}
+
+bool ResultRing::push(Trade *trade)
+{
+    uint64_t t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) > mask)
+    {
+        return false;
+    }
+    slots[t & mask] = trade;
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+}
+
+bool ResultRing::pop(Trade *&trade)
+{
+    uint64_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire))
+    {
+        return false;
+    }
+    trade = slots[h & mask];
+    head.store(h + 1, std::memory_order_release);
+    return true;
+}
+
+bool ResultRing::ready() const
+{
+    return head.load(std::memory_order_relaxed) != tail.load(std::memory_order_acquire);
+}
+
+// Keeps an engine thread on one core so its books and balances stay in
+// that core's caches
+static void pinToCore(std::thread &t, size_t core)
+{
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core, &cpus);
+    int rc = pthread_setaffinity_np(t.native_handle(), sizeof(cpus), &cpus);
+    if (rc != 0)
+    {
+        std::cerr << "Failed to pin engine thread to core " << core << ": " << strerror(rc) << std::endl;
+    }
+}
+
+static std::atomic<uint64_t> nextInstance{1};
+
+Sequencer::Sequencer(size_t capacity)
+    : ring(capacity), instance(nextInstance.fetch_add(1, std::memory_order_relaxed))
+{
+}
+
+Sequencer::~Sequencer()
+{
+    stop();
+}
+
+bool Sequencer::openJournal(const std::string &path)
+{
+    journal.open(path, std::ios::out | std::ios::app);
+    if (!journal)
+    {
+        std::cerr << "Failed to open trade journal " << path << std::endl;
+        return false;
+    }
+    journalPath = path;
+    return true;
+}
+
+void Sequencer::start(Apply apply, size_t maxBatch, uint64_t windowUs)
+{
+    this->apply = std::move(apply);
+    this->maxBatch = maxBatch > 0 ? maxBatch : 1;
+    this->windowUs = windowUs;
+    thread = std::thread(&Sequencer::engineMain, this);
+    if (core >= 0)
+    {
+        pinToCore(thread, (size_t)core);
+    }
+    std::cout << "Sequencer: " << ring.capacity() << " ingress slot(s)";
+    if (core >= 0)
+    {
+        std::cout << ", core " << core;
+    }
+    if (!journalPath.empty())
+    {
+        std::cout << ", journal " << journalPath;
+    }
+    std::cout << std::endl;
+}
+
+void Sequencer::stop()
+{
+    stopping.store(true, std::memory_order_seq_cst);
+    engineParker.wake();
+    if (thread.joinable())
+    {
+        thread.join();
+    }
+}
+
+Sequencer::Issuer &Sequencer::issuer()
+{
+    // A worker may submit to several sequencers (one per shard); there are
+    // few enough that a scan beats a map
+    thread_local std::vector<std::pair<uint64_t, Issuer *>> mine;
+    for (auto &entry : mine)
+    {
+        if (entry.first == instance)
+        {
+            return *entry.second;
+        }
+    }
+    std::lock_guard<std::mutex> lock(issuersMtx);
+    issuers.push_back(std::make_unique<Issuer>());
+    mine.emplace_back(instance, issuers.back().get());
+    return *issuers.back();
+}
+
+bool Sequencer::submit(Trade &trade)
+{
+    Issuer &me = issuer();
+
+    // Counted before looking at stopping, so the engine thread either
+    // waits for this trade or this trade sees that it is stopping
+    publishing.fetch_add(1, std::memory_order_seq_cst);
+    if (stopping.load(std::memory_order_seq_cst))
+    {
+        publishing.fetch_sub(1, std::memory_order_release);
+        std::cerr << "Trade rejected: server is shutting down" << std::endl;
+        trade.ok = false;
+        return false;
+    }
+    bool waited = false;
+    while (!ring.push(IngressRing::Entry{&trade, &me}))
+    {
+        if (!waited)
+        {
+            fullWaits.fetch_add(1, std::memory_order_relaxed);
+            waited = true;
+        }
+        engineParker.wake();
+        std::this_thread::yield();
+    }
+    publishing.fetch_sub(1, std::memory_order_release);
+    engineParker.wake();
+
+    Trade *done;
+    for (int tries = 0; !me.results.pop(done); tries++)
+    {
+        if (tries < SPIN_TRIES)
+        {
+            std::this_thread::yield();
+        }
+        else
+        {
+            me.parker.park([&me]
+                           { return me.results.ready(); });
+        }
+    }
+    return trade.ok;
+}
+
+void Sequencer::engineMain()
+{
+    std::vector<Trade *> batch;
+    std::vector<Issuer *> owners;
+    batch.reserve(maxBatch);
+    owners.reserve(maxBatch);
+    IngressRing::Entry entry;
+    uint64_t position;
+
+    auto take = [&]() -> bool
+    {
+        if (!ring.pop(entry, position))
+        {
+            return false;
+        }
+        entry.trade->sequence = position + 1;
+        batch.push_back(entry.trade);
+        owners.push_back(static_cast<Issuer *>(entry.issuer));
+        return true;
+    };
+
+    int idle = 0;
+    while (true)
+    {
+        if (!take())
+        {
+            if (stopping.load(std::memory_order_seq_cst) &&
+                publishing.load(std::memory_order_acquire) == 0 && !ring.ready())
+            {
+                return; // Everything published has been applied
+            }
+            if (idle++ < SPIN_TRIES)
+            {
+                std::this_thread::yield();
+            }
+            else
+            {
+                engineParker.park([this]
+                                  { return ring.ready() || stopping.load(std::memory_order_relaxed); });
+            }
+            continue;
+        }
+        idle = 0;
+
+        while (batch.size() < maxBatch && take())
+        {
+        }
+
+        // Optionally hold the batch open a little longer for stragglers
+        if (windowUs > 0 && batch.size() < maxBatch && !stopping.load(std::memory_order_relaxed))
+        {
+            auto until = std::chrono::steady_clock::now() + std::chrono::microseconds(windowUs);
+            while (batch.size() < maxBatch && std::chrono::steady_clock::now() < until)
+            {
+                if (!take())
+                {
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+        apply(batch);
+        if (journal.is_open())
+        {
+            journalBatch(batch);
+        }
+        appliedCount.fetch_add(batch.size(), std::memory_order_relaxed);
+        batchCount.fetch_add(1, std::memory_order_relaxed);
+
+        // The issuer may read its trade as soon as it is pushed
+        for (size_t i = 0; i < batch.size(); i++)
+        {
+            while (!owners[i]->results.push(batch[i]))
+            {
+                std::this_thread::yield();
+            }
+            owners[i]->parker.wake();
+        }
+        batch.clear();
+        owners.clear();
+    }
+}
+
+void Sequencer::journalBatch(const std::vector<Trade *> &batch)
+{
+    for (const Trade *trade : batch)
+    {
+        journal << trade->sequence;
+        if (trade->action == OrderAction::New)
+        {
+            journal << (trade->buy ? " BUY " : " SELL ") << trade->symbol << " ";
+        }
+        else
+        {
+            journal << (trade->action == OrderAction::Cancel ? " CANCEL " : " REPLACE ") << trade->symbol << " "
+                    << trade->target_id << " ";
+        }
+        if (trade->action != OrderAction::Cancel)
+        {
+            journal << formatMicros(trade->amount_micros) << " " << formatCents(trade->price_cents) << " ";
+        }
+        journal << trade->user_id << (trade->ok ? " OK\n" : " REJECTED\n");
+    }
+    journal.flush();
+    if (!journal)
+    {
+        std::cerr << "Failed to write trade journal " << journalPath << "; journaling stopped" << std::endl;
+        journal.close();
+    }
+}
+
+void Sequencer::report(std::ostream &out) const
+{
+    size_t issuerCount;
+    {
+        std::lock_guard<std::mutex> lock(issuersMtx);
+        issuerCount = issuers.size();
+    }
+    out << "Sequencer: " << appliedCount.load(std::memory_order_relaxed) << " trade(s) in "
+        << batchCount.load(std::memory_order_relaxed) << " batch(es), " << issuerCount << " issuer(s), "
+        << fullWaits.load(std::memory_order_relaxed) << " full-ring wait(s)\n";
+}
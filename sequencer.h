@@ -0,0 +1,173 @@
+#ifndef SEQUENCER_H
+#define SEQUENCER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "trade.h"
+
+#define RESULT_RING_SIZE 16 // Per issuing thread; each has one trade out at a time
+#define SPIN_TRIES 64       // Yields before a waiting thread goes to sleep
+
+// Lets a thread that has run out of work sleep without making the threads
+// that hand it work take a lock, unless it really is asleep
+class Parker
+{
+public:
+    // Sleeps until wake(), unless ready() is already true once the sleep
+    // has been announced. May return early; callers check again.
+    void park(const std::function<bool()> &ready);
+
+    // Called after publishing work for the parked thread
+    void wake();
+
+private:
+    std::atomic<bool> sleeping{false};
+    std::mutex mtx;
+    std::condition_variable cv;
+};
+
+// Bounded lock-free queue of trades from many threads to one (Vyukov's
+// bounded queue, single consumer). Every slot carries a sequence number: a
+// producer claims a position with one CAS and publishes by advancing its
+// slot's number, and the consumer takes slots strictly in position order,
+// so positions double as a global order.
+class IngressRing
+{
+public:
+    struct Entry
+    {
+        Trade *trade;
+        void *issuer; // Where the result goes back to
+    };
+
+    explicit IngressRing(size_t capacity); // Rounded up to a power of two
+
+    // Any thread. False when every slot is taken.
+    bool push(const Entry &entry);
+
+    // Consumer only; position is the entry's place in the global order
+    bool pop(Entry &entry, uint64_t &position);
+    bool ready() const; // The next position has been published
+
+    size_t capacity() const { return mask + 1; }
+
+private:
+    struct Slot
+    {
+        std::atomic<uint64_t> sequence; // position when free, position + 1 once published
+        Entry entry;
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    size_t mask;
+    alignas(64) std::atomic<uint64_t> tail{0}; // Next position to claim
+    alignas(64) uint64_t head = 0;             // Next position to take
+};
+
+// Bounded lock-free queue of finished trades from the engine thread back to
+// one issuing thread
+class ResultRing
+{
+public:
+    explicit ResultRing(size_t capacity); // Rounded up to a power of two
+
+    bool push(Trade *trade); // Engine thread only; false when full
+    bool pop(Trade *&trade); // Issuing thread only
+    bool ready() const;
+
+private:
+    std::unique_ptr<Trade *[]> slots;
+    size_t mask;
+    alignas(64) std::atomic<uint64_t> head{0}; // Written by the issuer
+    alignas(64) std::atomic<uint64_t> tail{0}; // Written by the engine
+};
+
+// Single-writer front end of the trade executors, LMAX style. Worker
+// threads publish trades into one IngressRing and a single engine thread
+// applies them, in batches, strictly in ring order, so the trade engine
+// and the account state behind it are only ever touched by that thread.
+// Each trade is numbered by its ring position (from 1). Results go back
+// through a ResultRing owned by the issuing worker, so neither direction
+// takes a lock while threads are busy; only a thread that has gone to
+// sleep (see Parker) is woken through a mutex.
+//
+// With a journal open, every applied trade is appended to it after its
+// batch, as "<sequence> BUY|SELL <symbol> <amount> <price> <user_id>
+// OK|REJECTED" (CANCEL and REPLACE likewise), for auditing and for
+// replaying a day's order flow: the text between the sequence and the
+// outcome is the command as a client would send it.
+class Sequencer
+{
+public:
+    using Apply = std::function<void(std::vector<Trade *> &)>;
+
+    explicit Sequencer(size_t capacity);
+    ~Sequencer();
+
+    bool openJournal(const std::string &path);
+
+    // Starts the engine thread. It passes apply() batches of up to maxBatch
+    // trades in sequence order, waiting up to windowUs after the first for
+    // the batch to fill; apply() sets each trade's outcome.
+    void start(Apply apply, size_t maxBatch, uint64_t windowUs);
+
+    // Keeps the engine thread on one core once started
+    void pin(size_t core) { this->core = (int)core; }
+
+    // Applies everything already published, then stops the engine thread
+    void stop();
+
+    // Any thread: publishes trade and waits until it has been applied.
+    // Returns trade.ok; trades submitted after stop() are rejected.
+    bool submit(Trade &trade);
+
+    size_t capacity() const { return ring.capacity(); }
+    void report(std::ostream &out) const;
+
+private:
+    struct Issuer
+    {
+        Issuer() : results(RESULT_RING_SIZE) {}
+
+        ResultRing results;
+        Parker parker;
+    };
+
+    Issuer &issuer(); // The calling thread's, created on first use
+    void engineMain();
+    void journalBatch(const std::vector<Trade *> &batch);
+
+    IngressRing ring;
+    Parker engineParker;
+    Apply apply;
+    size_t maxBatch = 1;
+    uint64_t windowUs = 0;
+    int core = -1; // -1 leaves the engine thread unpinned
+    std::thread thread;
+
+    std::atomic<bool> stopping{false};
+    std::atomic<uint64_t> publishing{0}; // Submitters between their stopping check and their push
+
+    uint64_t instance; // Tells this sequencer's issuers apart from an earlier one's
+    mutable std::mutex issuersMtx; // Only taken when a thread submits for the first time
+    std::vector<std::unique_ptr<Issuer>> issuers;
+
+    std::ofstream journal;
+    std::string journalPath;
+
+    std::atomic<uint64_t> appliedCount{0}; // Also the last sequence number applied
+    std::atomic<uint64_t> batchCount{0};
+    std::atomic<uint64_t> fullWaits{0}; // Submitters that found the ring full
+};
+
+#endif
@@ -1,373 +1,138 @@
 #include <iostream>
-#include <cstring>
-#include <cstdlib>
-#include <unistd.h>
-#include <arpa/inet.h>
+#include <memory>
 #include <string>
-#include <sstream>
-#include <sqlite3.h>
+#include <thread>
+#include "account_cache.h"
 #include "database.h"
-
-#define SERVER_PORT 5432
-#define MAX_PENDING 5
-#define MAX_LINE 256
-
-int main()
+#include "db_pool.h"
+#include "db_profile.h"
+#include "commands.h"
+#include "group_commit.h"
+#include "matching_engine.h"
+#include "sequencer.h"
+#include "shard_router.h"
+#include "symbol_table.h"
+#include "write_behind.h"
+#include "acceptor_group.h"
+#include "server_config.h"
+
+int main(int argc, char *argv[])
 {
-    struct sockaddr_in sin;
-    char buf[MAX_LINE];
-    int addr_len = sizeof(sin);
-    int s, new_s;
-    bool shutdownRequested = false;
-
-    // Initialize the database when the server starts
-    std::string dbName = "trading.db";
-    if (!initializeDatabase(dbName))
+    ServerConfig config;
+    if (!parseServerArgs(argc, argv, config))
     {
-        std::cerr << "Failed to initialize database!" << std::endl;
-        return 1; // Exit if the database setup fails
+        return 1;
     }
 
-    std::cout << "Database initialized. Server is ready to accept connections.\n";
-
-    // Build address data structure
-    memset(&sin, 0, sizeof(sin));
-    sin.sin_family = AF_INET;
-    sin.sin_addr.s_addr = INADDR_ANY;
-    sin.sin_port = htons(SERVER_PORT);
+    DbProfile profile;
+    findDbProfile(config.dbProfile, profile); // Validated by parseServerArgs
 
-    // Setup passive open
-    if ((s = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    // Initialize the database when the server starts
+    if (!initializeDatabase(config.dbName, profile))
     {
-        perror("Socket creation failed");
-        exit(1);
+        std::cerr << "Failed to initialize database!" << std::endl;
+        return 1; // Exit if the database setup fails
     }
 
-    if (bind(s, (struct sockaddr *)&sin, sizeof(sin)) < 0)
+    // Connections stay open for the life of the server; workers borrow them
+    DbPool db(config.dbName, config.dbReaders, profile);
+    if (!db.open())
     {
-        perror("Bind failed");
-        exit(1);
+        std::cerr << "Failed to open database connections!" << std::endl;
+        return 1;
     }
 
-    if (listen(s, MAX_PENDING) < 0)
+    // Balances and risk checks are served from memory from here on
+    // Symbols are interned first, since positions are keyed by symbol ID
+    SymbolTable symbols;
+    AccountCache accounts(config.shards);
     {
-        perror("Listen failed");
-        exit(1);
+        DbLease lease(db, DbRole::Writer);
+        if (!lease.ok() || (!config.symbols.empty() && !importSymbols(lease.db(), config.symbols)) ||
+            !loadSymbols(lease.db(), symbols) || !loadAccounts(lease.db(), symbols, accounts))
+        {
+            std::cerr << "Failed to load accounts!" << std::endl;
+            return 1;
+        }
     }
 
-    std::cout << "Server listening on port " << SERVER_PORT << "..." << std::endl;
-
-    // Main server loop: accept new clients, then read their messages
-    while (!shutdownRequested)
+    // Trades from every worker are routed by symbol to a shard, sequenced
+    // onto its engine thread, then committed in shared transactions, or
+    // with write-behind queued for a background flush. With several shards
+    // the engine threads are pinned from the last core down, away from the
+    // acceptors.
+    ShardRouter trades;
+    size_t cores = std::thread::hardware_concurrency();
+    for (size_t i = 0; i < config.shards; i++)
     {
-        if ((new_s = accept(s, (struct sockaddr *)&sin, (socklen_t *)&addr_len)) < 0)
+        auto sequencer = std::make_unique<Sequencer>(config.ringSize);
+        std::string journal = config.journal;
+        if (!journal.empty() && config.shards > 1)
         {
-            perror("Accept failed");
-            exit(1);
+            journal += "." + std::to_string(i);
         }
-
-        std::cout << "Client connected!" << std::endl;
-
-        // Process messages from this client until they disconnect
-        while (true)
+        if (!journal.empty() && !sequencer->openJournal(journal))
         {
-            memset(buf, 0, sizeof(buf)); // Clear the buffer
-            int buf_len = recv(new_s, buf, sizeof(buf), 0);
-            if (buf_len <= 0)
-            {
-                std::cout << "Client disconnected.\n";
-                break;
-            }
-
-            // Null-terminate the received string to safely use it
-            buf[buf_len] = '\0';
-
-            // Convert the received C-string into a std::string for easier parsing
-            std::string input(buf);
-
-            // Parse the command
-            std::istringstream iss(input);
-            std::string command, stock_symbol;
-            double stock_amount, price_per_stock;
-            int user_id;
-            iss >> command;
-
-            if (command == "BUY")
-            {
-                // Extract required parameters
-                if (!(iss >> stock_symbol >> stock_amount >> price_per_stock >> user_id))
-                {
-                    std::cerr << "Invalid BUY command format received: " << input << std::endl;
-                    std::string errorMsg = "400 Bad Request: Invalid BUY format\n";
-                    send(new_s, errorMsg.c_str(), errorMsg.length(), 0);
-                    continue;
-                }
-
-                // Check for negative numbers in the BUY command parameters.
-                // If any negative value is provided, reject the command.
-                if (stock_amount < 0 || price_per_stock < 0 || user_id < 0)
-                {
-                    std::cerr << "Invalid BUY command: Negative values are not allowed (" << input << ")" << std::endl;
-                    std::string errorMsg = "400 Bad Request: Negative values are not permitted in BUY command\n";
-                    send(new_s, errorMsg.c_str(), errorMsg.length(), 0);
-                    continue;
-                }
-
-                // Log received command
-                std::cout << "s: Received: BUY " << stock_symbol << " " << stock_amount
-                          << " " << price_per_stock << " " << user_id << std::endl;
-
-                // Attempt to process the stock purchase
-                if (buyStock(stock_symbol, stock_symbol, stock_amount, price_per_stock, user_id, dbName))
-                {
-                    // Get updated user balance and stock balance
-                    double new_usd_balance = 0.0;
-                    double new_stock_balance = 0.0;
-
-                    // Query updated balances
-                    sqlite3 *db;
-                    sqlite3_stmt *stmt;
-                    if (openDatabase(&db, dbName))
-                    {
-                        const char *getBalanceSQL = "SELECT usd_balance FROM Users WHERE ID = ?;";
-                        sqlite3_prepare_v2(db, getBalanceSQL, -1, &stmt, nullptr);
-                        sqlite3_bind_int(stmt, 1, user_id);
-
-                        if (sqlite3_step(stmt) == SQLITE_ROW)
-                        {
-                            new_usd_balance = sqlite3_column_double(stmt, 0);
-                        }
-
-                        sqlite3_finalize(stmt);
-
-                        const char *getStockSQL = "SELECT stock_balance FROM Stocks WHERE stock_symbol = ? AND user_id = ?;";
-                        sqlite3_prepare_v2(db, getStockSQL, -1, &stmt, nullptr);
-                        sqlite3_bind_text(stmt, 1, stock_symbol.c_str(), -1, SQLITE_STATIC);
-                        sqlite3_bind_int(stmt, 2, user_id);
-
-                        if (sqlite3_step(stmt) == SQLITE_ROW)
-                        {
-                            new_stock_balance = sqlite3_column_double(stmt, 0);
-                        }
-
-                        sqlite3_finalize(stmt);
-                        sqlite3_close(db);
-                    }
-
-                    std::ostringstream response;
-                    response << "200 OK\nBOUGHT: New balance: " << new_stock_balance
-                             << " " << stock_symbol << ". USD balance $" << new_usd_balance << "\n";
-                    send(new_s, response.str().c_str(), response.str().length(), 0);
-                }
-                else
-                {
-                    std::string errorMsg = "400 Bad Request: Transaction failed\n";
-                    send(new_s, errorMsg.c_str(), errorMsg.length(), 0);
-                }
-            }
-            else if (command == "SELL")
-            {
-                // Extract required parameters
-                if (!(iss >> stock_symbol >> stock_amount >> price_per_stock >> user_id))
-                {
-                    std::cerr << "Invalid SELL command format received: " << input << std::endl;
-                    std::string errorMsg = "400 Bad Request: Invalid SELL format\n";
-                    send(new_s, errorMsg.c_str(), errorMsg.length(), 0);
-                    continue;
-                }
-
-                // Check for negative numbers in the SELL command parameters.
-                if (stock_amount < 0 || price_per_stock < 0 || user_id < 0)
-                {
-                    std::cerr << "Invalid SELL command: Negative values are not allowed (" << input << ")" << std::endl;
-                    std::string errorMsg = "400 Bad Request: Negative values are not permitted in SELL command\n";
-                    send(new_s, errorMsg.c_str(), errorMsg.length(), 0);
-                    continue;
-                }
-
-                // Log received command
-                std::cout << "s: Received: SELL " << stock_symbol << " " << stock_amount
-                          << " " << price_per_stock << " " << user_id << std::endl;
-
-                // Attempt to process the stock sale
-                if (sellStock(stock_symbol, stock_amount, price_per_stock, user_id, dbName))
-                {
-                    double new_usd_balance = 0.0;
-                    double new_stock_balance = 0.0;
-
-                    // Query updated balances
-                    sqlite3 *db;
-                    sqlite3_stmt *stmt;
-                    if (openDatabase(&db, dbName))
-                    {
-                        const char *getBalanceSQL = "SELECT usd_balance FROM Users WHERE ID = ?;";
-                        sqlite3_prepare_v2(db, getBalanceSQL, -1, &stmt, nullptr);
-                        sqlite3_bind_int(stmt, 1, user_id);
-
-                        if (sqlite3_step(stmt) == SQLITE_ROW)
-                        {
-                            new_usd_balance = sqlite3_column_double(stmt, 0);
-                        }
-
-                        sqlite3_finalize(stmt);
-
-                        const char *getStockSQL = "SELECT stock_balance FROM Stocks WHERE stock_symbol = ? AND user_id = ?;";
-                        sqlite3_prepare_v2(db, getStockSQL, -1, &stmt, nullptr);
-                        sqlite3_bind_text(stmt, 1, stock_symbol.c_str(), -1, SQLITE_STATIC);
-                        sqlite3_bind_int(stmt, 2, user_id);
-
-                        if (sqlite3_step(stmt) == SQLITE_ROW)
-                        {
-                            new_stock_balance = sqlite3_column_double(stmt, 0);
-                        }
-
-                        sqlite3_finalize(stmt);
-                        sqlite3_close(db);
-                    }
-
-                    std::ostringstream response;
-                    response << "200 OK\nSOLD: New balance: " << new_stock_balance
-                             << " " << stock_symbol << ". USD $" << new_usd_balance << "\n";
-                    send(new_s, response.str().c_str(), response.str().length(), 0);
-                }
-                else
-                {
-                    std::string errorMsg = "400 Bad Request: Transaction failed\n";
-                    send(new_s, errorMsg.c_str(), errorMsg.length(), 0);
-                }
-            }
-            else if (command == "LIST")
-            {
-                // Log received command
-                std::cout << "s: Received: LIST" << std::endl;
-
-                // Prepare the response
-                std::ostringstream response;
-
-                // Initialize the SQLite database pointer and statement pointer
-                sqlite3 *db;
-                sqlite3_stmt *stmt;
-                const char *dbName = "trading.db"; // Ensure this is your database path
-
-                if (openDatabase(&db, dbName))
-                {
-                    const char *schemaQuery = "SELECT name FROM sqlite_master WHERE type='table' AND name='Stocks';";
-
-                    // Prepare the schema query to check if 'Stocks' table exists
-                    int schemaRc = sqlite3_prepare_v2(db, schemaQuery, -1, &stmt, nullptr);
-                    if (schemaRc != SQLITE_OK)
-                    {
-                        std::cerr << "Failed to prepare schema query: " << sqlite3_errmsg(db) << std::endl;
-                        sqlite3_finalize(stmt);
-                        sqlite3_close(db);
-                        return 0; // Stop further execution if schema query fails
-                    }
-
-                    if (sqlite3_step(stmt) == SQLITE_ROW)
-                    {
-                        std::cout << "Stocks table exists." << std::endl;
-                    }
-                    else
-                    {
-                        std::cout << "Stocks table does not exist." << std::endl;
-                        sqlite3_finalize(stmt);
-                        sqlite3_close(db);
-                        return 0; // Stop if the table does not exist
-                    }
-                    sqlite3_finalize(stmt); // Finalize the schema check statement
-
-                    const char *query = "SELECT ID, stock_symbol, stock_name, stock_balance, user_id FROM Stocks;";
-
-                    // Prepare the SELECT statement to get stocks
-                    int rc = sqlite3_prepare_v2(db, query, -1, &stmt, nullptr);
-                    if (rc != SQLITE_OK)
-                    {
-                        std::cerr << "Failed to prepare SELECT statement: " << sqlite3_errmsg(db) << std::endl;
-                        sqlite3_finalize(stmt);
-                        sqlite3_close(db);
-                        std::string errorMsg = "400 Bad Request: Unable to list stocks\n";
-                        send(new_s, errorMsg.c_str(), errorMsg.length(), 0);
-                        return 0; // Stop further execution if query preparation fails
-                    }
-
-                    // Start building the response
-                    response << "200 OK\nThe list of stocks:\n";
-
-                    // Iterate over the query results
-                    while (sqlite3_step(stmt) == SQLITE_ROW)
-                    {
-                        int stock_id = sqlite3_column_int(stmt, 0);
-                        const char *stock_symbol = (const char *)sqlite3_column_text(stmt, 1);
-                        const char *stock_name = (const char *)sqlite3_column_text(stmt, 2);
-                        double stock_balance = sqlite3_column_double(stmt, 3);
-                        int user_id = sqlite3_column_int(stmt, 4);
-
-                        // Append the data to the response
-                        response << stock_id << " " << stock_symbol << " " << stock_name << " " << stock_balance << " " << user_id << "\n";
-                    }
-
-                    sqlite3_finalize(stmt); // Finalize the SELECT statement
-                    sqlite3_close(db);      // Close the database connection
-
-                    // Send the response to the client
-                    send(new_s, response.str().c_str(), response.str().length(), 0);
-                }
-                else
-                {
-                    std::string errorMsg = "400 Bad Request: Unable to open database\n";
-                    send(new_s, errorMsg.c_str(), errorMsg.length(), 0);
-                }
-            }
-            else if (command == "BALANCE")
-            {
-                std::cout << "s: Received: BALANCE" << std::endl;
-
-                int user_id = 1; // Always show balance for user 1
-                std::string first_name, last_name;
-                double usd_balance;
-
-                if (getUserBalance(user_id, first_name, last_name, usd_balance, dbName))
-                {
-                    std::ostringstream response;
-                    response << "200 OK\n"
-                             << "Balance for user " << first_name << " " << last_name
-                             << ": $" << usd_balance << "\n";
-                    std::string responseStr = response.str();
-
-                    std::cout << "Sending response: " << responseStr; // Debug log
-                    send(new_s, responseStr.c_str(), responseStr.length(), 0);
-                }
-                else
-                {
-                    std::string errorMsg = "404 Not Found\nUser with ID " + std::to_string(user_id) + " does not exist.\n";
-                    std::cout << "Sending error response: " << errorMsg; // Debug log
-                    send(new_s, errorMsg.c_str(), errorMsg.length(), 0);
-                }
-            }
-
-            else if (command == "SHUTDOWN")
-            {
-                std::cout << "Received: SHUTDOWN" << std::endl;
-                shutdownRequested = true;
-                break;
-            }
-
-            else
-            {
-                std::string errorMsg = "400 Bad Request: Invalid Command\n";
-                send(new_s, errorMsg.c_str(), errorMsg.length(), 0);
-            }
+            return 1;
+        }
+        if (config.shards > 1 && cores > 0)
+        {
+            sequencer->pin(cores - 1 - i % cores);
         }
 
-        close(new_s);
-        // If shutdown is requested, break from the outer loop too
-        if (shutdownRequested)
+        std::unique_ptr<TradeEngine> engine;
+        if (config.matching == Matching::Book)
+        {
+            engine = std::make_unique<BookEngine>(accounts, symbols.size(), i, config.shards);
+        }
+        else
+        {
+            engine = std::make_unique<DirectEngine>();
+        }
+        std::unique_ptr<TradeExecutor> executor;
+        if (config.persistence == Persistence::WriteBehind)
         {
-            std::cout << "Shutting down the server..." << std::endl;
-            break;
+            executor = std::make_unique<WriteBehindFlusher>(db, accounts, symbols, *engine, *sequencer,
+                                                            config.flushIntervalMs, config.flushBatch,
+                                                            config.flushQueueMax);
         }
+        else
+        {
+            executor = std::make_unique<GroupCommitter>(db, accounts, symbols, *engine, *sequencer,
+                                                        config.groupCommitMax, config.groupCommitWindowUs);
+        }
+        trades.add(std::move(sequencer), std::move(engine), std::move(executor));
+    }
+    trades.start();
+    CommandContext ctx{db, trades, accounts, symbols};
+
+    std::cout << "Database initialized. Server is ready to accept connections.\n";
+
+    // Each acceptor runs its own epoll loop and worker pool until SHUTDOWN
+    AcceptorGroup server(config, ctx);
+    if (!server.start())
+    {
+        return 1;
+    }
+    server.wait();
+    trades.stop(); // Write-behind drains its queue here
+    trades.report(std::cout);
+
+    uint64_t hits, misses;
+    size_t cached;
+    db.statementStats(hits, misses, cached);
+    std::cout << "Statement cache: " << hits << " hit(s), " << misses << " miss(es), "
+              << cached << " statement(s) cached" << std::endl;
+
+    uint64_t lookups = accounts.hits() + accounts.misses();
+    std::cout << "Account cache: " << accounts.users() << " user(s), " << accounts.positions() << " position(s), "
+              << accounts.hits() << " hit(s), " << accounts.misses() << " miss(es)";
+    if (lookups > 0)
+    {
+        std::cout << " (" << (accounts.hits() * 100 / lookups) << "% hit rate)";
     }
+    std::cout << std::endl;
 
-    close(s);
+    std::cout << "Server stopped." << std::endl;
     return 0;
 }
@@ -0,0 +1,278 @@
+#include <iostream>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include "server_config.h"
+#include "db_profile.h"
+
+static void printUsage(const char *prog)
+{
+    std::cerr << "Usage: " << prog << " [options]\n"
+              << "  --db <path>                  SQLite database file (default trading.db)\n"
+              << "  --workers <n>                Worker threads executing commands (default: one per core)\n"
+              << "  --queue-depth <n>            Commands allowed to wait for a worker (default 1024)\n"
+              << "  --db-readers <n>             Database connections kept open for reads (default: one per worker)\n"
+              << "  --group-commit-max <n>       Trades committed in one transaction at most (default 256, 1 = no grouping)\n"
+              << "  --group-commit-window <us>   How long a group waits for more trades (default 0: only those already queued)\n"
+              << "  --symbols <path>             List the symbols in this file (\"SYMBOL [name]\" per line) before starting\n"
+              << "  --shards <n>                 Engine threads, each pinned to a core and trading its share of the symbols (default 1).\n"
+              << "                               With write-through they all commit through one SQLite writer, so only write-behind scales\n"
+              << "  --ring-size <n>              Trades queued per engine thread, rounded up to a power of two (default 4096)\n"
+              << "  --journal <path>             Append every sequenced trade and its outcome to this file (<path>.<shard> with several shards)\n"
+              << "  --engine <name>              direct (default) settles at the client's price; book matches limit orders\n"
+              << "  --persistence <mode>         write-through (default) or write-behind, which answers trades before they reach disk\n"
+              << "  --flush-interval <ms>        Write-behind: flush queued changes this often (default 100)\n"
+              << "  --flush-batch <n>            Write-behind: ...or as soon as this many are queued (default 4096)\n"
+              << "  --flush-queue-max <n>        Write-behind: queued changes beyond this are dropped (default 1000000)\n"
+              << "  --db-profile <name>          Durability settings: " << dbProfileNames() << " (default " << DEFAULT_DB_PROFILE << ")\n"
+              << "  --acceptors <n>              Independent SO_REUSEPORT listeners, one per core (default 1)\n"
+              << "  --io-backend <name>          epoll (default) or io_uring, which falls back to epoll if unsupported\n"
+              << "  --unix-socket <path>         Also listen on a Unix domain socket, which offers shared-memory rings\n"
+              << "  --backlog <n>                Listen backlog (default " << MAX_PENDING << ")\n"
+              << "  --max-connections <n>        Open connections before new clients are refused with 503 (default 10000)\n"
+              << "  --output-high-water <bytes>  Unsent reply bytes that pause reading a client (default 1 MiB)\n"
+              << "  --output-low-water <bytes>   Level they must drain to before reading resumes (default 256 KiB)\n"
+              << "  --idle-timeout <sec>         Close TCP clients with nothing pending after this (default 300, 0 = never)\n"
+              << "  --request-timeout <ms>       Answer 504 for TCP commands not started by then (default 10000, 0 = never)\n"
+              << "  --unix-idle-timeout <sec>    Idle timeout for the Unix socket listener (default 300)\n"
+              << "  --unix-request-timeout <ms>  Request timeout for the Unix socket listener (default 10000)\n";
+}
+
+// Reads a positive integer option value, rejecting junk and zero
+static bool parseCount(const char *text, size_t &out)
+{
+    char *end = nullptr;
+    long long value = strtoll(text, &end, 10);
+    if (end == text || *end != '\0' || value <= 0)
+    {
+        return false;
+    }
+    out = static_cast<size_t>(value);
+    return true;
+}
+
+// Reads a timeout value; unlike a count, zero is allowed and means "off"
+static bool parseTimeout(const char *text, uint64_t scaleMs, uint64_t &outMs)
+{
+    char *end = nullptr;
+    long long value = strtoll(text, &end, 10);
+    if (end == text || *end != '\0' || value < 0)
+    {
+        return false;
+    }
+    outMs = static_cast<uint64_t>(value) * scaleMs;
+    return true;
+}
+
+bool parseServerArgs(int argc, char *argv[], ServerConfig &config)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            std::cerr << "Missing value for " << arg << std::endl;
+            printUsage(argv[0]);
+            return false;
+        }
+        const char *value = argv[++i];
+
+        bool ok = true;
+        if (arg == "--db")
+        {
+            config.dbName = value;
+        }
+        else if (arg == "--workers")
+        {
+            ok = parseCount(value, config.workerThreads);
+        }
+        else if (arg == "--queue-depth")
+        {
+            ok = parseCount(value, config.queueDepth);
+        }
+        else if (arg == "--group-commit-max")
+        {
+            ok = parseCount(value, config.groupCommitMax);
+        }
+        else if (arg == "--group-commit-window")
+        {
+            ok = parseTimeout(value, 1, config.groupCommitWindowUs);
+        }
+        else if (arg == "--symbols")
+        {
+            config.symbols = value;
+        }
+        else if (arg == "--shards")
+        {
+            ok = parseCount(value, config.shards) && config.shards > 0;
+        }
+        else if (arg == "--ring-size")
+        {
+            ok = parseCount(value, config.ringSize);
+        }
+        else if (arg == "--journal")
+        {
+            config.journal = value;
+        }
+        else if (arg == "--engine")
+        {
+            std::string name = value;
+            if (name == "direct")
+            {
+                config.matching = Matching::Direct;
+            }
+            else if (name == "book")
+            {
+                config.matching = Matching::Book;
+            }
+            else
+            {
+                ok = false;
+            }
+        }
+        else if (arg == "--persistence")
+        {
+            std::string name = value;
+            if (name == "write-through")
+            {
+                config.persistence = Persistence::WriteThrough;
+            }
+            else if (name == "write-behind")
+            {
+                config.persistence = Persistence::WriteBehind;
+            }
+            else
+            {
+                ok = false;
+            }
+        }
+        else if (arg == "--flush-interval")
+        {
+            ok = parseTimeout(value, 1, config.flushIntervalMs) && config.flushIntervalMs > 0;
+        }
+        else if (arg == "--flush-batch")
+        {
+            ok = parseCount(value, config.flushBatch);
+        }
+        else if (arg == "--flush-queue-max")
+        {
+            ok = parseCount(value, config.flushQueueMax);
+        }
+        else if (arg == "--db-profile")
+        {
+            DbProfile profile;
+            config.dbProfile = value;
+            ok = findDbProfile(config.dbProfile, profile);
+        }
+        else if (arg == "--db-readers")
+        {
+            ok = parseCount(value, config.dbReaders);
+        }
+        else if (arg == "--acceptors")
+        {
+            ok = parseCount(value, config.acceptors);
+        }
+        else if (arg == "--backlog")
+        {
+            size_t backlog = 0;
+            ok = parseCount(value, backlog) && backlog <= 65535;
+            config.backlog = (int)backlog;
+        }
+        else if (arg == "--max-connections")
+        {
+            ok = parseCount(value, config.maxConnections);
+        }
+        else if (arg == "--output-high-water")
+        {
+            ok = parseCount(value, config.outputHighWater);
+        }
+        else if (arg == "--output-low-water")
+        {
+            ok = parseCount(value, config.outputLowWater);
+        }
+        else if (arg == "--idle-timeout")
+        {
+            ok = parseTimeout(value, 1000, config.idleTimeoutMs);
+        }
+        else if (arg == "--request-timeout")
+        {
+            ok = parseTimeout(value, 1, config.requestTimeoutMs);
+        }
+        else if (arg == "--unix-idle-timeout")
+        {
+            ok = parseTimeout(value, 1000, config.unixIdleTimeoutMs);
+        }
+        else if (arg == "--unix-request-timeout")
+        {
+            ok = parseTimeout(value, 1, config.unixRequestTimeoutMs);
+        }
+        else if (arg == "--unix-socket")
+        {
+            config.unixSocket = value;
+            ok = !config.unixSocket.empty();
+        }
+        else if (arg == "--io-backend")
+        {
+            std::string name = value;
+            if (name == "epoll")
+            {
+                config.ioBackend = IoBackend::Epoll;
+            }
+            else if (name == "io_uring")
+            {
+                config.ioBackend = IoBackend::IoUring;
+            }
+            else
+            {
+                ok = false;
+            }
+        }
+        else
+        {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            printUsage(argv[0]);
+            return false;
+        }
+
+        if (!ok)
+        {
+            std::cerr << "Invalid value for " << arg << ": " << value << std::endl;
+            printUsage(argv[0]);
+            return false;
+        }
+    }
+
+    if (config.outputLowWater >= config.outputHighWater)
+    {
+        std::cerr << "--output-low-water must be below --output-high-water" << std::endl;
+        printUsage(argv[0]);
+        return false;
+    }
+
+    if (config.workerThreads == 0)
+    {
+        config.workerThreads = std::thread::hardware_concurrency();
+        if (config.workerThreads == 0)
+        {
+            config.workerThreads = 1;
+        }
+    }
+
+    // Enough read connections that no worker ever waits for one. Workers are
+    // split between the acceptors, and the Unix listener gets a share too.
+    if (config.dbReaders == 0)
+    {
+        size_t workersEach = config.workerThreads / config.acceptors;
+        size_t pools = config.acceptors + (config.unixSocket.empty() ? 0 : 1);
+        config.dbReaders = (workersEach > 0 ? workersEach : 1) * pools;
+    }
+
+    // Every shard's group commits queue for the one SQLite writer and its
+    // fsync, so write-through throughput stays that of a single shard
+    if (config.shards > 1 && config.persistence == Persistence::WriteThrough)
+    {
+        std::cerr << "Warning: with write-through all shards commit through one SQLite writer, "
+                  << "so extra shards add little throughput; use --persistence write-behind to scale" << std::endl;
+    }
+    return true;
+}
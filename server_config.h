@@ -0,0 +1,72 @@
+#ifndef SERVER_CONFIG_H
+#define SERVER_CONFIG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "db_profile.h"
+
+#define SERVER_PORT 5432
+#define MAX_PENDING 128 // Default listen backlog
+
+// I/O backend a server loop uses to drive its sockets
+enum class IoBackend
+{
+    Epoll,
+    IoUring // Falls back to Epoll when the kernel lacks what it needs
+};
+
+// When trades reach SQLite
+enum class Persistence
+{
+    WriteThrough, // Committed before the trade is answered (group commit)
+    WriteBehind   // Answered from memory, flushed by a background thread
+};
+
+// What a BUY or SELL trades against
+enum class Matching
+{
+    Direct, // The house, at the client's price
+    Book    // Other users' orders, through a limit order book per symbol
+};
+
+// Startup options for the server, filled in from the command line
+struct ServerConfig
+{
+    std::string dbName = "trading.db";
+    std::string dbProfile = DEFAULT_DB_PROFILE; // See db_profile.cpp
+    uint16_t port = SERVER_PORT;
+    int backlog = MAX_PENDING;
+    size_t acceptors = 1;     // >1 opens one SO_REUSEPORT listener per pinned thread
+    IoBackend ioBackend = IoBackend::Epoll;
+    size_t workerThreads = 0; // 0 means one per core
+    size_t queueDepth = 1024; // Jobs allowed to wait for a worker
+    size_t dbReaders = 0;     // Read-only database connections; 0 means one per worker thread
+    size_t groupCommitMax = 256;     // Trades sharing one transaction at most
+    uint64_t groupCommitWindowUs = 0; // Extra wait for more trades; 0 takes what is already queued
+    size_t shards = 1;        // Engine threads, each trading its own share of the symbols
+    size_t ringSize = 4096;   // Trade slots between the workers and each engine thread
+    std::string journal;      // Sequenced trade log for audit and replay; empty for none
+    std::string symbols;      // Symbol list to add to the symbol master at startup; empty for none
+    Matching matching = Matching::Direct;
+    Persistence persistence = Persistence::WriteThrough;
+    uint64_t flushIntervalMs = 100; // Write-behind: longest a change waits to be flushed...
+    size_t flushBatch = 4096;       // ...unless this many are waiting first
+    size_t flushQueueMax = 1000000; // Pending changes beyond this are dropped
+    std::string unixSocket;   // Extra Unix domain listener for local clients; empty for none
+    size_t maxConnections = 10000;        // Across all loops; clients beyond it get a 503
+    size_t outputHighWater = 1024 * 1024; // Unsent reply bytes at which a client stops being read
+    size_t outputLowWater = 256 * 1024;   // ...and the level it must drain to before reading resumes
+
+    // Timeouts per listener; 0 disables
+    uint64_t idleTimeoutMs = 300000;        // TCP clients with nothing pending are closed after this
+    uint64_t requestTimeoutMs = 10000;      // Commands not done by then are answered 504
+    uint64_t unixIdleTimeoutMs = 300000;    // The same for the Unix socket listener
+    uint64_t unixRequestTimeoutMs = 10000;
+};
+
+// Parses --option value pairs into config. Prints usage and returns false on
+// an unknown option or a bad value.
+bool parseServerArgs(int argc, char *argv[], ServerConfig &config);
+
+#endif
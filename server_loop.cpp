@@ -0,0 +1,383 @@
+#include <iostream>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include "protocol.h"
+#include "server_loop.h"
+
+ServerLoop::ServerLoop(WorkerPool &workers, const LoopLimits &limits)
+    : workers(workers), limits(limits), timers(TimerWheel::nowMs())
+{
+}
+
+ServerLoop::~ServerLoop()
+{
+    if (timer_fd >= 0)
+    {
+        close(timer_fd);
+    }
+}
+
+bool ServerLoop::initTimers()
+{
+    if ((timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+    {
+        perror("timerfd_create failed");
+        return false;
+    }
+
+    housekeeping.callback = [this]
+    { runHousekeeping(); };
+    housekeeping.interval = HOUSEKEEPING_INTERVAL_MS;
+    timers.schedule(housekeeping, HOUSEKEEPING_INTERVAL_MS);
+    return true;
+}
+
+void ServerLoop::handleTimers()
+{
+    uint64_t expirations;
+    if (read(timer_fd, &expirations, sizeof(expirations)) < 0)
+    {
+        // EAGAIN: woken for something else
+    }
+    timerDueMs = 0; // One-shot, so it is disarmed now
+    timers.advance(TimerWheel::nowMs());
+}
+
+void ServerLoop::rearmTimers()
+{
+    // Only touch the timerfd when the earliest deadline moves, which for
+    // long idle timeouts is about once per level-0 turn, not per request
+    uint64_t due = timers.nextDueMs();
+    if (due == timerDueMs)
+    {
+        return;
+    }
+    timerDueMs = due;
+
+    struct itimerspec its = {};
+    its.it_value.tv_sec = due / 1000;
+    its.it_value.tv_nsec = (due % 1000) * 1000000;
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, nullptr);
+}
+
+void ServerLoop::runHousekeeping()
+{
+    if (rejectedClients || idleClosed || requestsTimedOut)
+    {
+        std::cout << "Last " << HOUSEKEEPING_INTERVAL_MS / 1000 << "s: " << rejectedClients
+                  << " client(s) rejected at the connection limit, " << idleClosed
+                  << " idle client(s) closed, " << requestsTimedOut << " command(s) timed out" << std::endl;
+    }
+    rejectedClients = 0;
+    idleClosed = 0;
+    requestsTimedOut = 0;
+}
+
+void ServerLoop::onIdleTimeout(int fd)
+{
+    auto it = connections.find(fd);
+    if (it == connections.end())
+    {
+        return;
+    }
+    Connection &conn = it->second;
+
+    // Waiting on us is not idle. Unsent output is: that client stopped reading.
+    if (conn.inFlight || !conn.commands.empty())
+    {
+        timers.schedule(conn.idleTimer, limits.idleTimeoutMs);
+        return;
+    }
+
+    idleClosed++;
+    std::cout << "Closing idle client." << std::endl;
+    closeConnection(fd);
+}
+
+void ServerLoop::stop()
+{
+    shutdownRequested = true;
+    completions.wake();
+}
+
+void ServerLoop::setShutdownHandler(std::function<void()> handler)
+{
+    onShutdown = std::move(handler);
+}
+
+bool ServerLoop::writePending(const Connection &) const
+{
+    return false;
+}
+
+bool ServerLoop::attachSharedMemory(Connection &)
+{
+    return false;
+}
+
+size_t ServerLoop::unsentBytes(const Connection &conn) const
+{
+    return conn.output.size();
+}
+
+void ServerLoop::pauseReading(Connection &)
+{
+}
+
+void ServerLoop::resumeReading(Connection &)
+{
+}
+
+bool ServerLoop::admitConnection(int fd)
+{
+    if (connections.size() < limits.maxConnections)
+    {
+        return true;
+    }
+
+    // Best effort: a fresh socket has room for one short line
+    const char reply[] = "503 Service Unavailable: Too many connections\n";
+    send(fd, reply, sizeof(reply) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+    rejectedClients++;
+    return false;
+}
+
+Connection &ServerLoop::addConnection(int fd)
+{
+    Connection &conn = connections[fd];
+    conn.fd = fd;
+    conn.id = nextConnId++;
+    conn.idleTimer.callback = [this, fd]
+    { onIdleTimeout(fd); };
+    if (limits.idleTimeoutMs)
+    {
+        timers.schedule(conn.idleTimer, limits.idleTimeoutMs);
+    }
+    std::cout << "Client connected!" << std::endl;
+    return conn;
+}
+
+void ServerLoop::handleInput(Connection &conn)
+{
+    if (limits.idleTimeoutMs)
+    {
+        timers.schedule(conn.idleTimer, limits.idleTimeoutMs);
+    }
+
+    // Decode no further than MAX_QUEUED_COMMANDS ahead; the rest waits in
+    // conn.input until the queue drains
+    std::string frame;
+    while (conn.commands.size() < MAX_QUEUED_COMMANDS)
+    {
+        FrameStatus status = decodeFrame(conn.input, conn.inputMode, frame);
+        if (status == FrameStatus::Incomplete)
+        {
+            break;
+        }
+        if (status == FrameStatus::Invalid)
+        {
+            std::cerr << "Dropping client: frame larger than " << MAX_FRAME_SIZE << " bytes" << std::endl;
+            closeConnection(conn.fd);
+            return;
+        }
+        PendingCommand command;
+        command.replyMode = conn.inputMode;
+
+        // Every frame gets exactly one reply, or a client waiting on it
+        // would block forever
+        if (frame.empty())
+        {
+            command.local = true;
+            command.localResponse = conn.inputMode == FrameMode::Binary
+                                        ? encodeErrorReply(STATUS_BAD_REQUEST)
+                                        : "400 Bad Request: Empty command\n";
+            conn.commands.push_back(std::move(command));
+            continue;
+        }
+
+        // FRAMING changes how the very next bytes are decoded, so it is
+        // applied here rather than on a worker
+        FrameMode mode;
+        bool valid;
+        if (conn.inputMode != FrameMode::Binary && parseFramingRequest(frame, mode, valid))
+        {
+            command.local = true;
+            if (valid)
+            {
+                conn.inputMode = mode;
+                command.localResponse = "200 OK\n";
+            }
+            else
+            {
+                command.localResponse = "400 Bad Request: Unknown framing\n";
+            }
+        }
+        else if (conn.inputMode == FrameMode::Text && frame == "TRANSPORT SHM")
+        {
+            command.local = true;
+            command.upgrade = true;
+        }
+        command.text = std::move(frame);
+        conn.commands.push_back(std::move(command));
+    }
+
+    if (dispatchNext(conn))
+    {
+        updateBackpressure(conn);
+        finishIfDone(conn);
+    }
+}
+
+void ServerLoop::handleWritten(Connection &conn)
+{
+    // Draining output may be what paused work was waiting for
+    if (conn.readPaused || !conn.commands.empty() || !conn.input.empty())
+    {
+        handleInput(conn);
+        return;
+    }
+    finishIfDone(conn);
+}
+
+void ServerLoop::updateBackpressure(Connection &conn)
+{
+    size_t unsent = unsentBytes(conn);
+    bool full = unsent >= limits.outputHighWater || conn.commands.size() >= MAX_QUEUED_COMMANDS;
+    if (!conn.readPaused && full)
+    {
+        conn.readPaused = true;
+        pauseReading(conn);
+    }
+    else if (conn.readPaused && !full && unsent <= limits.outputLowWater)
+    {
+        conn.readPaused = false;
+        resumeReading(conn);
+    }
+}
+
+bool ServerLoop::dispatchNext(Connection &conn)
+{
+    // A client that is not reading its replies gets no more work run for it
+    while (!conn.inFlight && !conn.commands.empty() && unsentBytes(conn) < limits.outputHighWater)
+    {
+        if (conn.commands.front().local)
+        {
+            PendingCommand &command = conn.commands.front();
+            if (command.upgrade)
+            {
+                // The reply carries descriptors, so everything before it
+                // must already be on the socket
+                if (flushOutput(conn) && conn.output.empty() && attachSharedMemory(conn))
+                {
+                    conn.commands.pop_front();
+                    continue;
+                }
+                command.localResponse = "400 Bad Request: Shared memory transport unavailable\n";
+            }
+            encodeFrame(conn.output, command.replyMode, std::move(command.localResponse));
+            conn.commands.pop_front();
+            continue;
+        }
+
+        // Pipelining: everything queued up to the next local command runs
+        // as one batch on one worker
+        CommandJob job;
+        job.fd = conn.fd;
+        job.conn_id = conn.id;
+        job.completions = &completions;
+        FrameMode replyMode = conn.commands.front().replyMode;
+        bool binary = replyMode == FrameMode::Binary;
+        job.binary = binary;
+        if (limits.requestTimeoutMs)
+        {
+            job.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(limits.requestTimeoutMs);
+        }
+        while (!conn.commands.empty() && !conn.commands.front().local &&
+               job.commands.size() < MAX_BATCH)
+        {
+            job.commands.push_back(std::move(conn.commands.front().text));
+            conn.commands.pop_front();
+        }
+
+        size_t batchSize = job.commands.size();
+        if (workers.submit(std::move(job)))
+        {
+            conn.inFlight = true;
+            conn.inFlightMode = replyMode;
+            break;
+        }
+
+        // Every worker is backed up; answer now rather than queue without bound
+        for (size_t i = 0; i < batchSize; i++)
+        {
+            encodeFrame(conn.output, replyMode,
+                        binary ? encodeErrorReply(STATUS_BUSY)
+                                   : "503 Service Unavailable: Server busy\n");
+        }
+    }
+
+    if (!flushOutput(conn))
+    {
+        closeConnection(conn.fd);
+        return false;
+    }
+    return true;
+}
+
+void ServerLoop::handleCompletions()
+{
+    std::vector<CommandResult> results;
+    completions.drain(results);
+
+    for (CommandResult &result : results)
+    {
+        if (result.shutdownRequested)
+        {
+            if (onShutdown)
+            {
+                onShutdown();
+            }
+            else
+            {
+                stop();
+            }
+        }
+
+        auto it = connections.find(result.fd);
+        if (it == connections.end() || it->second.id != result.conn_id)
+        {
+            continue; // The client went away while its command was running
+        }
+
+        Connection &conn = it->second;
+        conn.inFlight = false;
+        requestsTimedOut += result.timedOut;
+        for (std::string &response : result.responses)
+        {
+            encodeFrame(conn.output, conn.inFlightMode, std::move(response));
+        }
+
+        // Queue the next batch before writing so everything ready goes out
+        // in one gathered write
+        if (shutdownRequested)
+        {
+            if (!flushOutput(conn))
+            {
+                closeConnection(conn.fd);
+            }
+            continue;
+        }
+        handleInput(conn);
+    }
+}
+
+void ServerLoop::finishIfDone(Connection &conn)
+{
+    if (conn.peerClosed && !conn.inFlight && conn.commands.empty() &&
+        conn.output.empty() && !writePending(conn))
+    {
+        std::cout << "Client disconnected.\n";
+        closeConnection(conn.fd);
+    }
+}
@@ -0,0 +1,151 @@
+#ifndef SERVER_LOOP_H
+#define SERVER_LOOP_H
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include "framing.h"
+#include "thread_pool.h"
+#include "timer_wheel.h"
+
+#define READ_CHUNK 4096
+#define MAX_BATCH 64 // Commands from one connection sent to a worker together
+#define MAX_IOV 64   // Segments written per writev()/sendmsg()
+#define MAX_QUEUED_COMMANDS 1024 // Decoded commands a connection may have waiting
+#define HOUSEKEEPING_INTERVAL_MS 10000
+
+// Admission, backpressure and timeout limits for one loop (so per listener)
+struct LoopLimits
+{
+    size_t maxConnections = 10000;
+    size_t outputHighWater = 1024 * 1024; // Stop reading a client with this much unsent output...
+    size_t outputLowWater = 256 * 1024;   // ...until it drains back down to this
+    uint64_t idleTimeoutMs = 300000;      // Close clients with no work pending for this long; 0 disables
+    uint64_t requestTimeoutMs = 10000;    // Answer 504 for commands not started by then; 0 disables
+};
+
+// A decoded command waiting for its turn. The reply goes out in the framing
+// that was in effect when the command arrived, so a FRAMING switch does not
+// change how earlier commands are answered.
+struct PendingCommand
+{
+    std::string text;
+    FrameMode replyMode;
+    bool local = false;        // Answered by the loop itself with localResponse
+    std::string localResponse;
+    bool upgrade = false;      // TRANSPORT SHM: move the client onto shared-memory rings
+};
+
+// Per-client state owned by a server loop
+struct Connection
+{
+    int fd = -1;
+    uint64_t id = 0;
+    ByteBuffer input;                    // Bytes received but not yet decoded into frames
+    OutputQueue output;                  // Encoded responses the socket has not taken yet
+    FrameMode inputMode = FrameMode::Text;
+    std::deque<PendingCommand> commands; // Decoded commands waiting for their turn
+    bool inFlight = false;               // A worker is running a batch of our commands
+    FrameMode inFlightMode = FrameMode::Text;
+    Timer idleTimer;
+    bool peerClosed = false;             // Close once the remaining work is answered
+    bool readPaused = false;             // Backpressure: the backend is not reading this client
+};
+
+// The backend-independent half of a server loop: decodes received bytes into
+// frames, hands each connection's queued commands to the worker pool as one
+// ordered batch (one batch in flight per connection, so responses come back
+// in request order) and queues all of the batch's responses for a single
+// gathered write.
+// It also applies backpressure: a client whose replies pile up unsent, or
+// who has MAX_QUEUED_COMMANDS waiting, is not read from (and its queued
+// commands are not run) until it catches up.
+// Subclasses own the sockets and decide how bytes are read and written.
+class ServerLoop
+{
+public:
+    ServerLoop(WorkerPool &workers, const LoopLimits &limits);
+    virtual ~ServerLoop();
+
+    virtual bool init() = 0;
+    virtual void run() = 0;
+
+    // Makes run() return; safe to call from any thread
+    void stop();
+
+    // Called instead of stop() when a client sends SHUTDOWN, so a group of
+    // loops can shut down together
+    void setShutdownHandler(std::function<void()> handler);
+
+protected:
+    // Returns false, after telling the client why, when the loop is already
+    // at its connection limit; the caller then closes fd
+    bool admitConnection(int fd);
+
+    // The wheel is driven by one timerfd per loop: backends watch timerFd()
+    // and call handleTimers() when it fires, and rearmTimers() before they
+    // go back to sleep
+    bool initTimers();
+    int timerFd() const { return timer_fd; }
+    void handleTimers();
+    void rearmTimers();
+
+    Connection &addConnection(int fd);
+    void handleInput(Connection &conn);
+    // Backends call this after a write made progress
+    void handleWritten(Connection &conn);
+    void handleCompletions();
+    void finishIfDone(Connection &conn);
+
+    // Starts sending conn.output. Returns false if the socket failed, in
+    // which case the caller closes the connection.
+    virtual bool flushOutput(Connection &conn) = 0;
+
+    // True while the backend still holds bytes it has not finished writing
+    virtual bool writePending(const Connection &conn) const;
+
+    // Reply bytes not yet taken by the socket, including any the backend holds
+    virtual size_t unsentBytes(const Connection &conn) const;
+
+    // Stop/restart reading conn's socket; conn.readPaused is already updated
+    virtual void pauseReading(Connection &conn);
+    virtual void resumeReading(Connection &conn);
+
+    // Closes the socket and removes it from connections
+    virtual void closeConnection(int fd) = 0;
+
+    // Answers TRANSPORT SHM by sending "200 OK" together with the ring
+    // descriptors. From then on the connection's bytes flow through the
+    // rings. Returns false when this loop or socket cannot do that.
+    virtual bool attachSharedMemory(Connection &conn);
+
+    WorkerPool &workers;
+    LoopLimits limits;
+    CompletionQueue completions;
+    std::atomic<bool> shutdownRequested{false};
+    TimerWheel timers; // Declared before connections, whose timers it holds
+    std::unordered_map<int, Connection> connections;
+
+private:
+    bool dispatchNext(Connection &conn);
+    void updateBackpressure(Connection &conn);
+    void onIdleTimeout(int fd);
+    void runHousekeeping();
+
+    uint64_t nextConnId = 1;
+    std::function<void()> onShutdown;
+
+    int timer_fd = -1;
+    uint64_t timerDueMs = 0; // What timer_fd is armed for; 0 when disarmed
+    Timer housekeeping;
+
+    // Reported and reset by the housekeeping task rather than logged one by one
+    size_t rejectedClients = 0;
+    size_t idleClosed = 0;
+    size_t requestsTimedOut = 0;
+};
+
+#endif
@@ -0,0 +1,48 @@
+#include <iostream>
+#include "shard_router.h"
+#include "symbol_table.h"
+
+void ShardRouter::add(std::unique_ptr<Sequencer> sequencer, std::unique_ptr<TradeEngine> engine,
+                      std::unique_ptr<TradeExecutor> executor)
+{
+    shards.push_back(Shard{std::move(sequencer), std::move(engine), std::move(executor)});
+}
+
+void ShardRouter::start()
+{
+    for (Shard &shard : shards)
+    {
+        shard.executor->start();
+    }
+    std::cout << "Trading on " << shards.size() << " shard(s)" << std::endl;
+}
+
+void ShardRouter::stop()
+{
+    // Each shard drains its own ring; stopping them one after another
+    // lets the later ones keep trading meanwhile
+    for (Shard &shard : shards)
+    {
+        shard.executor->stop();
+    }
+}
+
+bool ShardRouter::execute(Trade &trade)
+{
+    if (trade.symbol_id == SYMBOL_NONE)
+    {
+        trade.ok = false;
+        return false;
+    }
+    return shards[shardOf(trade.symbol_id, shards.size())].executor->execute(trade);
+}
+
+void ShardRouter::report(std::ostream &out) const
+{
+    out << "Shards: " << shards.size() << "\n";
+    for (size_t i = 0; i < shards.size(); i++)
+    {
+        out << "Shard " << i << ":\n";
+        shards[i].executor->report(out);
+    }
+}
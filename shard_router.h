@@ -0,0 +1,44 @@
+#ifndef SHARD_ROUTER_H
+#define SHARD_ROUTER_H
+
+#include <memory>
+#include <vector>
+#include "sequencer.h"
+#include "trade.h"
+
+// Splits trading across execution shards, one per engine thread. Each
+// shard has its own Sequencer, engine and executor and owns a fixed subset
+// of the symbols (see shardOf()), so the books and positions of a symbol
+// are only ever touched by its shard's thread. The one thing shards share
+// is a user's cash, which they take through AccountCache reservations
+// rather than a lock.
+class ShardRouter : public TradeExecutor
+{
+public:
+    // Shard i trades the symbols shardOf() maps to i; executor must run
+    // its trades through sequencer and engine
+    void add(std::unique_ptr<Sequencer> sequencer, std::unique_ptr<TradeEngine> engine,
+             std::unique_ptr<TradeExecutor> executor);
+
+    void start() override;
+    void stop() override;
+
+    bool execute(Trade &trade) override;
+
+    void report(std::ostream &out) const override;
+
+    size_t size() const { return shards.size(); }
+
+private:
+    // Declared so the executor goes first and the sequencer last
+    struct Shard
+    {
+        std::unique_ptr<Sequencer> sequencer;
+        std::unique_ptr<TradeEngine> engine;
+        std::unique_ptr<TradeExecutor> executor;
+    };
+
+    std::vector<Shard> shards;
+};
+
+#endif
@@ -0,0 +1,206 @@
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include "shm_ring.h"
+
+// Layout of the shared mapping
+struct ShmRegion
+{
+    ShmRingHeader toServer;
+    ShmRingHeader toClient;
+    char toServerData[SHM_RING_SIZE];
+    char toClientData[SHM_RING_SIZE];
+};
+
+void ShmRing::attach(ShmRingHeader *header, char *data)
+{
+    this->header = header;
+    this->data = data;
+}
+
+size_t ShmRing::write(const char *bytes, size_t len)
+{
+    uint64_t head = header->head.load(std::memory_order_relaxed);
+    uint64_t tail = header->tail.load(std::memory_order_acquire);
+    if (head - tail > SHM_RING_SIZE)
+    {
+        return SHM_RING_BROKEN; // The consumer moved tail past head or too far behind it
+    }
+    size_t space = SHM_RING_SIZE - (size_t)(head - tail);
+    if (len > space)
+    {
+        len = space;
+    }
+
+    // Copy in up to two pieces around the end of the buffer
+    size_t offset = head & (SHM_RING_SIZE - 1);
+    size_t first = len < SHM_RING_SIZE - offset ? len : SHM_RING_SIZE - offset;
+    memcpy(data + offset, bytes, first);
+    memcpy(data, bytes + first, len - first);
+
+    // seq_cst so the store is ordered before readerShouldWake()'s load
+    header->head.store(head + len);
+    return len;
+}
+
+size_t ShmRing::read(char *bytes, size_t len)
+{
+    uint64_t tail = header->tail.load(std::memory_order_relaxed);
+    uint64_t head = header->head.load(std::memory_order_acquire);
+    if (head - tail > SHM_RING_SIZE)
+    {
+        return SHM_RING_BROKEN; // The producer claims more than the ring holds
+    }
+    size_t available = (size_t)(head - tail);
+    if (len > available)
+    {
+        len = available;
+    }
+
+    size_t offset = tail & (SHM_RING_SIZE - 1);
+    size_t first = len < SHM_RING_SIZE - offset ? len : SHM_RING_SIZE - offset;
+    memcpy(bytes, data + offset, first);
+    memcpy(bytes + first, data, len - first);
+
+    header->tail.store(tail + len);
+    return len;
+}
+
+bool ShmRing::parkReader()
+{
+    header->readerWaiting.store(1);
+    if (header->head.load() != header->tail.load(std::memory_order_relaxed))
+    {
+        header->readerWaiting.store(0);
+        return false;
+    }
+    return true;
+}
+
+bool ShmRing::readerShouldWake()
+{
+    return header->readerWaiting.load() && header->readerWaiting.exchange(0);
+}
+
+bool ShmRing::parkWriter()
+{
+    header->writerWaiting.store(1);
+    if (header->head.load(std::memory_order_relaxed) - header->tail.load() != SHM_RING_SIZE)
+    {
+        header->writerWaiting.store(0);
+        return false;
+    }
+    return true;
+}
+
+bool ShmRing::writerShouldWake()
+{
+    return header->writerWaiting.load() && header->writerWaiting.exchange(0);
+}
+
+ShmChannel::~ShmChannel()
+{
+    if (base)
+    {
+        munmap(base, sizeof(ShmRegion));
+    }
+    closeMemfd();
+    if (serverEfd >= 0)
+    {
+        close(serverEfd);
+    }
+    if (clientEfd >= 0)
+    {
+        close(clientEfd);
+    }
+}
+
+bool ShmChannel::create()
+{
+    if ((memfd = memfd_create("trading-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0)
+    {
+        perror("memfd_create failed");
+        return false;
+    }
+    if (ftruncate(memfd, sizeof(ShmRegion)) < 0)
+    {
+        perror("Failed to size shared ring");
+        return false;
+    }
+    // The client gets this fd; without the seals it could truncate the
+    // file and our next access to the mapping would SIGBUS the server
+    if (fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0)
+    {
+        perror("Failed to seal shared ring");
+        return false;
+    }
+    if ((serverEfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 ||
+        (clientEfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+    {
+        perror("eventfd failed");
+        return false;
+    }
+    return map(true);
+}
+
+bool ShmChannel::attach(int memfd, int serverEfd, int clientEfd)
+{
+    this->memfd = memfd;
+    this->serverEfd = serverEfd;
+    this->clientEfd = clientEfd;
+    return map(false);
+}
+
+void ShmChannel::closeMemfd()
+{
+    if (memfd >= 0)
+    {
+        close(memfd);
+        memfd = -1;
+    }
+}
+
+bool ShmChannel::map(bool initialize)
+{
+    base = mmap(nullptr, sizeof(ShmRegion), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (base == MAP_FAILED)
+    {
+        base = nullptr;
+        perror("Failed to map shared ring");
+        return false;
+    }
+
+    ShmRegion *region = (ShmRegion *)base;
+    if (initialize)
+    {
+        // A fresh memfd is zero filled; construct the atomics in place on it
+        new (&region->toServer) ShmRingHeader();
+        new (&region->toClient) ShmRingHeader();
+        region->toServer.readerWaiting.store(1); // The server loop sleeps until told otherwise
+    }
+    toServer.attach(&region->toServer, region->toServerData);
+    toClient.attach(&region->toClient, region->toClientData);
+    return true;
+}
+
+void ShmChannel::signal(int efd)
+{
+    uint64_t one = 1;
+    if (write(efd, &one, sizeof(one)) < 0)
+    {
+        // EAGAIN only if the counter is about to overflow, so it is already set
+    }
+}
+
+void ShmChannel::drainSignal(int efd)
+{
+    uint64_t count;
+    if (read(efd, &count, sizeof(count)) < 0)
+    {
+        // EAGAIN: nothing was pending
+    }
+}
@@ -0,0 +1,96 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#define SHM_RING_SIZE (256 * 1024) // Bytes per direction; must be a power of two
+#define SHM_RING_BROKEN ((size_t)-1) // read/write result when the peer corrupted the indexes
+
+static_assert((SHM_RING_SIZE & (SHM_RING_SIZE - 1)) == 0, "SHM_RING_SIZE must be a power of two");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "ring indexes must be lock-free to share across processes");
+
+// Control block of one ring, shared between two processes. head is only
+// written by the producer and tail only by the consumer; each sits on its
+// own cache line so the two sides do not fight over it.
+struct ShmRingHeader
+{
+    alignas(64) std::atomic<uint64_t> head; // Total bytes ever written
+    alignas(64) std::atomic<uint64_t> tail; // Total bytes ever read
+    alignas(64) std::atomic<uint32_t> readerWaiting; // Consumer is asleep on its eventfd
+    std::atomic<uint32_t> writerWaiting;             // Producer is asleep waiting for space
+};
+
+// Lock-free single-producer/single-consumer byte ring over shared memory.
+// It carries the same byte stream a socket would, so framing works on it
+// unchanged. Nothing here sleeps: the park/shouldWake calls let each side
+// decide when an eventfd signal is needed, so a busy stream costs no
+// syscalls at all.
+class ShmRing
+{
+public:
+    void attach(ShmRingHeader *header, char *data);
+
+    // Copies up to len bytes in/out; returns how many (0 when full/empty).
+    // The other process can write anything into the shared indexes, so a
+    // head/tail more than SHM_RING_SIZE apart returns SHM_RING_BROKEN
+    // without touching the buffer; the caller should drop that peer.
+    size_t write(const char *bytes, size_t len);
+    size_t read(char *bytes, size_t len);
+
+    // Consumer found the ring empty and wants to sleep. Returns false if
+    // data arrived meanwhile, in which case it should read again instead.
+    bool parkReader();
+    // Producer after writing: true if the consumer must be signalled
+    bool readerShouldWake();
+
+    // The same handshake for a producer that found the ring full. Only an
+    // exactly full ring parks; corrupt indexes send it back to write()
+    // so that reports them.
+    bool parkWriter();
+    bool writerShouldWake();
+
+private:
+    ShmRingHeader *header = nullptr;
+    char *data = nullptr;
+};
+
+// The pair of rings for one client plus the eventfds that wake each side:
+// the server sleeps on serverEfd, the client on clientEfd. Both rings live
+// in one memfd mapping that is handed to the client over the Unix socket.
+class ShmChannel
+{
+public:
+    ShmChannel() = default;
+    ShmChannel(const ShmChannel &) = delete;
+    ShmChannel &operator=(const ShmChannel &) = delete;
+    ~ShmChannel();
+
+    // Server side: creates the sealed memfd (its size cannot change once
+    // handed out), the mapping and both eventfds
+    bool create();
+
+    // Client side: maps descriptors received from the server, taking
+    // ownership of them
+    bool attach(int memfd, int serverEfd, int clientEfd);
+
+    // Releases the memfd once it has been passed on; the mapping stays valid
+    void closeMemfd();
+
+    static void signal(int efd);
+    static void drainSignal(int efd);
+
+    ShmRing toServer;
+    ShmRing toClient;
+    int memfd = -1;
+    int serverEfd = -1;
+    int clientEfd = -1;
+
+private:
+    bool map(bool initialize);
+
+    void *base = nullptr;
+};
+
+#endif
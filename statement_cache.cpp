@@ -0,0 +1,55 @@
+#include "statement_cache.h"
+
+StatementCache::~StatementCache()
+{
+    clear();
+}
+
+int StatementCache::prepare(sqlite3 *db, const char *sql, sqlite3_stmt **stmt)
+{
+    auto it = statements.find(sql);
+    if (it != statements.end())
+    {
+        hitCount.fetch_add(1, std::memory_order_relaxed);
+
+        // Cheap if the last user already reset it, and makes sure a
+        // forgotten SELECT no longer holds its read lock
+        sqlite3_reset(it->second);
+        sqlite3_clear_bindings(it->second);
+        *stmt = it->second;
+        return SQLITE_OK;
+    }
+
+    missCount.fetch_add(1, std::memory_order_relaxed);
+    int rc = sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, stmt, nullptr);
+    if (rc != SQLITE_OK)
+    {
+        sqlite3_finalize(*stmt);
+        *stmt = nullptr;
+        return rc;
+    }
+    statements.emplace(sql, *stmt);
+    return SQLITE_OK;
+}
+
+int StatementCache::exec(sqlite3 *db, const char *sql)
+{
+    sqlite3_stmt *stmt;
+    int rc = prepare(db, sql, &stmt);
+    if (rc != SQLITE_OK)
+    {
+        return rc;
+    }
+    rc = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+void StatementCache::clear()
+{
+    for (auto &entry : statements)
+    {
+        sqlite3_finalize(entry.second);
+    }
+    statements.clear();
+}
@@ -0,0 +1,47 @@
+#ifndef STATEMENT_CACHE_H
+#define STATEMENT_CACHE_H
+
+#include <sqlite3.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+// Prepared statements of one connection, keyed by their SQL text, so each
+// query is compiled once per connection instead of once per request.
+// Callers sqlite3_reset() a statement when done with it rather than
+// finalizing it; the cache owns it until clear().
+class StatementCache
+{
+public:
+    StatementCache() = default;
+    ~StatementCache();
+
+    StatementCache(const StatementCache &) = delete;
+    StatementCache &operator=(const StatementCache &) = delete;
+
+    // Same contract as sqlite3_prepare_v2(): on SQLITE_OK *stmt is ready to
+    // bind and step, already reset and with no bindings left over
+    int prepare(sqlite3 *db, const char *sql, sqlite3_stmt **stmt);
+
+    // Runs a cached statement that takes no parameters and returns no rows
+    // (BEGIN, COMMIT, SAVEPOINT...). Returns SQLITE_OK or the error.
+    int exec(sqlite3 *db, const char *sql);
+
+    // Finalizes everything; must run before the connection is closed
+    void clear();
+
+    size_t size() const { return statements.size(); }
+    uint64_t hits() const { return hitCount.load(std::memory_order_relaxed); }
+    uint64_t misses() const { return missCount.load(std::memory_order_relaxed); }
+
+private:
+    std::unordered_map<std::string, sqlite3_stmt *> statements;
+
+    // Only the thread holding the connection writes these; others may read
+    std::atomic<uint64_t> hitCount{0};
+    std::atomic<uint64_t> missCount{0};
+};
+
+#endif
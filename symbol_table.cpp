@@ -0,0 +1,88 @@
+#include <cstring>
+#include "symbol_table.h"
+
+// FNV-1a; tickers are a handful of bytes
+uint32_t SymbolTable::hashOf(const char *symbol, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= (uint8_t)symbol[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+uint32_t SymbolTable::find(const char *symbol, size_t length) const
+{
+    if (length == 0 || length > maxLength)
+    {
+        return SYMBOL_NONE;
+    }
+    uint32_t hash = hashOf(symbol, length);
+    size_t mask = slots.size() - 1;
+    for (size_t i = hash & mask; slots[i].id != SYMBOL_NONE; i = (i + 1) & mask)
+    {
+        if (slots[i].hash == hash)
+        {
+            const std::string &listed = symbols[slots[i].id].symbol;
+            if (listed.size() == length && memcmp(listed.data(), symbol, length) == 0)
+            {
+                return slots[i].id;
+            }
+        }
+    }
+    return SYMBOL_NONE;
+}
+
+uint32_t SymbolTable::add(const std::string &symbol, const std::string &name)
+{
+    uint32_t existing = find(symbol);
+    if (existing != SYMBOL_NONE)
+    {
+        return existing;
+    }
+    if ((symbols.size() + 1) * 2 > slots.size())
+    {
+        grow();
+    }
+
+    uint32_t id = (uint32_t)symbols.size();
+    symbols.push_back(Listing{symbol, name.empty() ? symbol : name});
+    if (symbol.size() > maxLength)
+    {
+        maxLength = symbol.size();
+    }
+
+    uint32_t hash = hashOf(symbol.data(), symbol.size());
+    size_t mask = slots.size() - 1;
+    size_t i = hash & mask;
+    while (slots[i].id != SYMBOL_NONE)
+    {
+        i = (i + 1) & mask;
+    }
+    slots[i].hash = hash;
+    slots[i].id = id;
+    return id;
+}
+
+void SymbolTable::grow()
+{
+    std::vector<Slot> old;
+    old.swap(slots);
+    slots.resize(old.empty() ? 16 : old.size() * 2);
+    size_t mask = slots.size() - 1;
+    for (const Slot &slot : old)
+    {
+        if (slot.id == SYMBOL_NONE)
+        {
+            continue;
+        }
+        size_t i = slot.hash & mask;
+        while (slots[i].id != SYMBOL_NONE)
+        {
+            i = (i + 1) & mask;
+        }
+        slots[i] = slot;
+    }
+}
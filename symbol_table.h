@@ -0,0 +1,60 @@
+#ifndef SYMBOL_TABLE_H
+#define SYMBOL_TABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define SYMBOL_NONE UINT32_MAX // Not a listed symbol; also stands for the cash balance in balance keys
+
+// The execution shard, out of shards, that trades symbol. IDs are handed
+// out in listing order, so consecutive symbols land on different shards.
+inline size_t shardOf(uint32_t symbol, size_t shards) { return symbol % shards; }
+
+// The symbol master: every ticker that may be traded, interned into dense
+// IDs 0..size()-1 so positions, order books and queues can be arrays and
+// integer keys instead of strings. Filled while the server starts (see
+// loadSymbols()) and read-only afterwards, so any thread may look up
+// without locking.
+//
+// Lookups use an open-addressed table (linear probing, power-of-two
+// capacity, at most half full) that stores each ticker's hash next to its
+// ID, so a miss rarely touches the ticker text, and anything longer than
+// the longest listed ticker is rejected before hashing.
+class SymbolTable
+{
+public:
+    // Lists symbol under the next ID, or returns its existing ID
+    uint32_t add(const std::string &symbol, const std::string &name);
+
+    // SYMBOL_NONE if symbol is not listed
+    uint32_t find(const std::string &symbol) const { return find(symbol.data(), symbol.size()); }
+    uint32_t find(const char *symbol, size_t length) const;
+
+    const std::string &symbol(uint32_t id) const { return symbols[id].symbol; }
+    const std::string &name(uint32_t id) const { return symbols[id].name; }
+    size_t size() const { return symbols.size(); }
+
+private:
+    struct Listing
+    {
+        std::string symbol;
+        std::string name;
+    };
+
+    struct Slot
+    {
+        uint32_t hash = 0;
+        uint32_t id = SYMBOL_NONE; // SYMBOL_NONE marks a free slot
+    };
+
+    static uint32_t hashOf(const char *symbol, size_t length);
+    void grow();
+
+    std::vector<Listing> symbols; // Indexed by ID
+    std::vector<Slot> slots;
+    size_t maxLength = 0;
+};
+
+#endif
@@ -0,0 +1,162 @@
+#include <iostream>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "thread_pool.h"
+#include "commands.h"
+#include "protocol.h"
+
+CompletionQueue::CompletionQueue()
+{
+}
+
+CompletionQueue::~CompletionQueue()
+{
+    if (efd >= 0)
+    {
+        close(efd);
+    }
+}
+
+bool CompletionQueue::init()
+{
+    if ((efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+    {
+        perror("eventfd failed");
+        return false;
+    }
+    return true;
+}
+
+void CompletionQueue::push(CommandResult &&result)
+{
+    bool wasEmpty;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        wasEmpty = results.empty();
+        results.push_back(std::move(result));
+    }
+
+    // Only the first result of a batch needs to wake the loop
+    if (wasEmpty)
+    {
+        wake();
+    }
+}
+
+void CompletionQueue::wake()
+{
+    uint64_t one = 1;
+    if (write(efd, &one, sizeof(one)) < 0)
+    {
+        perror("eventfd write failed");
+    }
+}
+
+void CompletionQueue::drain(std::vector<CommandResult> &out)
+{
+    uint64_t count;
+    while (read(efd, &count, sizeof(count)) > 0)
+    {
+    }
+
+    std::lock_guard<std::mutex> lock(mtx);
+    out.swap(results);
+}
+
+WorkerPool::WorkerPool(size_t threadCount, size_t queueDepth, CommandContext &ctx)
+    : numThreads(threadCount > 0 ? threadCount : 1), queueDepth(queueDepth), ctx(ctx)
+{
+}
+
+WorkerPool::~WorkerPool()
+{
+    stop();
+}
+
+void WorkerPool::start()
+{
+    for (size_t i = 0; i < numThreads; i++)
+    {
+        threads.emplace_back(&WorkerPool::workerMain, this);
+    }
+    std::cout << "Started " << numThreads << " worker thread(s), queue depth " << queueDepth << std::endl;
+}
+
+void WorkerPool::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+    }
+    cv.notify_all();
+
+    for (std::thread &t : threads)
+    {
+        t.join();
+    }
+    threads.clear();
+}
+
+bool WorkerPool::submit(CommandJob &&job)
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (stopping || jobs.size() >= queueDepth)
+        {
+            return false;
+        }
+        jobs.push_back(std::move(job));
+    }
+    cv.notify_one();
+    return true;
+}
+
+void WorkerPool::workerMain()
+{
+    while (true)
+    {
+        CommandJob job;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait(lock, [this]
+                    { return stopping || !jobs.empty(); });
+            if (stopping && jobs.empty())
+            {
+                return;
+            }
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+
+        CommandResult result;
+        result.fd = job.fd;
+        result.conn_id = job.conn_id;
+        result.shutdownRequested = false;
+        result.responses.reserve(job.commands.size());
+        for (const std::string &input : job.commands)
+        {
+            // Stale work is answered without touching the database. Only
+            // commands that never started get a 504; one that started may
+            // already have traded, so it always reports what really happened.
+            if (std::chrono::steady_clock::now() > job.deadline && (job.binary || !isShutdownCommand(input)))
+            {
+                result.responses.push_back(job.binary ? encodeErrorReply(STATUS_TIMEOUT)
+                                                      : TIMEOUT_RESPONSE);
+                result.timedOut++;
+                continue;
+            }
+            if (job.binary)
+            {
+                result.responses.push_back(handleBinaryCommand(input, ctx));
+                continue;
+            }
+            result.responses.push_back(handleCommand(input, ctx, result.shutdownRequested));
+            if (result.shutdownRequested)
+            {
+                break;
+            }
+        }
+        job.completions->push(std::move(result));
+    }
+}
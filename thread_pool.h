@@ -0,0 +1,92 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define TIMEOUT_RESPONSE "504 Gateway Timeout: Request did not finish in time\n"
+
+class CompletionQueue;
+struct CommandContext;
+
+// A batch of parsed commands from one connection, handed from the I/O
+// thread to a worker. The worker runs them in order.
+struct CommandJob
+{
+    int fd;
+    uint64_t conn_id; // Guards against the fd being reused by a new client
+    std::vector<std::string> commands;
+    bool binary = false; // Commands are protocol.h messages rather than text
+    // Commands still waiting when this passes are answered 504 without running
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    CompletionQueue *completions;
+};
+
+// The responses a worker produced for a CommandJob, one per command in the
+// same order (fewer if a SHUTDOWN cut the batch short)
+struct CommandResult
+{
+    int fd;
+    uint64_t conn_id;
+    std::vector<std::string> responses;
+    bool shutdownRequested;
+    size_t timedOut = 0; // Commands answered 504 without running
+};
+
+// Multi-producer queue of finished commands. Pushing signals an eventfd so
+// the owning event loop wakes up and writes the responses out.
+class CompletionQueue
+{
+public:
+    CompletionQueue();
+    ~CompletionQueue();
+
+    bool init();
+    int fd() const { return efd; }
+    void push(CommandResult &&result);
+    void drain(std::vector<CommandResult> &out);
+    void wake();
+
+private:
+    std::mutex mtx;
+    std::vector<CommandResult> results;
+    int efd = -1;
+};
+
+// Fixed-size pool of threads that execute commands against the database so
+// slow SQLite work never blocks socket I/O. Every pool in the process runs
+// its commands against the same ctx. submit() fails once queueDepth
+// jobs are waiting so callers can reject work instead of queueing forever.
+class WorkerPool
+{
+public:
+    WorkerPool(size_t threadCount, size_t queueDepth, CommandContext &ctx);
+    ~WorkerPool();
+
+    void start();
+    void stop();
+    bool submit(CommandJob &&job);
+
+    size_t threadCount() const { return numThreads; }
+
+private:
+    void workerMain();
+
+    size_t numThreads;
+    size_t queueDepth;
+    CommandContext &ctx;
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<CommandJob> jobs;
+    std::vector<std::thread> threads;
+    bool stopping = false;
+};
+
+#endif
@@ -0,0 +1,210 @@
+#include <ctime>
+#include "timer_wheel.h"
+
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define MAX_DELTA_TICKS ((1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1)
+
+Timer::~Timer()
+{
+    if (wheel)
+    {
+        wheel->cancel(*this);
+    }
+}
+
+TimerWheel::TimerWheel(uint64_t nowMs)
+    : current(nowMs / TIMER_TICK_MS)
+{
+}
+
+TimerWheel::~TimerWheel()
+{
+    // Detach whatever is still armed so its owner can outlive the wheel
+    for (int level = 0; level < WHEEL_LEVELS; level++)
+    {
+        for (int slot = 0; slot < WHEEL_SLOTS; slot++)
+        {
+            for (Timer *t = slots[level][slot]; t; t = t->next)
+            {
+                t->wheel = nullptr;
+            }
+        }
+    }
+}
+
+uint64_t TimerWheel::nowMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+void TimerWheel::schedule(Timer &timer, uint64_t delayMs)
+{
+    if (timer.wheel)
+    {
+        cancel(timer);
+    }
+
+    // With nothing armed the wheel may not have been advanced for a while
+    uint64_t nowTick = nowMs() / TIMER_TICK_MS;
+    if (count == 0 && nowTick > current)
+    {
+        current = nowTick;
+    }
+    uint64_t base = nowTick > current ? nowTick : current;
+
+    uint64_t ticks = (delayMs + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    if (ticks == 0)
+    {
+        ticks = 1;
+    }
+    if (base + ticks - current > MAX_DELTA_TICKS)
+    {
+        ticks = MAX_DELTA_TICKS - (base - current);
+    }
+
+    timer.expires = base + ticks;
+    timer.wheel = this;
+    insert(timer);
+    count++;
+}
+
+void TimerWheel::cancel(Timer &timer)
+{
+    if (timer.wheel != this)
+    {
+        return;
+    }
+    unlink(timer);
+    timer.wheel = nullptr;
+    count--;
+}
+
+void TimerWheel::insert(Timer &timer)
+{
+    // The level is the first whose span covers the remaining delay; the
+    // slot is the timer's expiry tick at that level's granularity
+    uint64_t delta = timer.expires - current;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= (1ULL << (WHEEL_BITS * (level + 1))))
+    {
+        level++;
+    }
+    int slot = (int)((timer.expires >> (WHEEL_BITS * level)) & WHEEL_MASK);
+
+    timer.level = (uint8_t)level;
+    timer.slot = (uint8_t)slot;
+    timer.prev = nullptr;
+    timer.next = slots[level][slot];
+    if (timer.next)
+    {
+        timer.next->prev = &timer;
+    }
+    slots[level][slot] = &timer;
+    occupied[level] |= 1ULL << slot;
+}
+
+void TimerWheel::unlink(Timer &timer)
+{
+    if (timer.prev)
+    {
+        timer.prev->next = timer.next;
+    }
+    else
+    {
+        slots[timer.level][timer.slot] = timer.next;
+        if (!timer.next)
+        {
+            occupied[timer.level] &= ~(1ULL << timer.slot);
+        }
+    }
+    if (timer.next)
+    {
+        timer.next->prev = timer.prev;
+    }
+    timer.prev = nullptr;
+    timer.next = nullptr;
+}
+
+void TimerWheel::tick()
+{
+    current++;
+
+    // Each time a level turns over, pull the next slot of the level above
+    // down; every timer in it now fits a lower level
+    for (int level = 1; level < WHEEL_LEVELS; level++)
+    {
+        if ((current & ((1ULL << (WHEEL_BITS * level)) - 1)) != 0)
+        {
+            break;
+        }
+        int slot = (int)((current >> (WHEEL_BITS * level)) & WHEEL_MASK);
+        Timer *t = slots[level][slot];
+        slots[level][slot] = nullptr;
+        occupied[level] &= ~(1ULL << slot);
+        while (t)
+        {
+            Timer *next = t->next;
+            insert(*t);
+            t = next;
+        }
+    }
+
+    // Everything in this level-0 slot expires now. Pop one at a time: a
+    // callback may cancel or destroy other timers in the same slot.
+    int slot = (int)(current & WHEEL_MASK);
+    while (Timer *t = slots[0][slot])
+    {
+        cancel(*t);
+        if (t->interval)
+        {
+            schedule(*t, t->interval);
+        }
+
+        // Copied because the callback may destroy the timer that owns it
+        std::function<void()> callback = t->callback;
+        if (callback)
+        {
+            callback();
+        }
+    }
+}
+
+void TimerWheel::advance(uint64_t nowMs)
+{
+    uint64_t target = nowMs / TIMER_TICK_MS;
+    while (current < target)
+    {
+        if (count == 0)
+        {
+            current = target;
+            break;
+        }
+        tick();
+    }
+}
+
+uint64_t TimerWheel::nextDueMs() const
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    // Ticks until the level-0 wheel wraps and the next cascade is due
+    uint64_t ticks = WHEEL_SLOTS - (current & WHEEL_MASK);
+    if (occupied[0])
+    {
+        // Rotate so bit 0 is the slot of the next tick
+        int shift = (int)((current + 1) & WHEEL_MASK);
+        uint64_t bits = shift ? (occupied[0] >> shift) | (occupied[0] << (WHEEL_SLOTS - shift)) : occupied[0];
+        uint64_t next = (uint64_t)__builtin_ctzll(bits) + 1;
+        if (next < ticks)
+        {
+            ticks = next;
+        }
+    }
+
+    return (current + ticks) * TIMER_TICK_MS;
+}
@@ -0,0 +1,80 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#define TIMER_TICK_MS 10
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4 // 64^4 ticks of 10ms: timers up to about 194 days
+
+class TimerWheel;
+
+// A timer embedded in the object it belongs to, so arming and re-arming it
+// never allocates. callback is set once by the owner. Destroying an armed
+// timer cancels it.
+class Timer
+{
+public:
+    Timer() = default;
+    Timer(const Timer &) = delete;
+    Timer &operator=(const Timer &) = delete;
+    ~Timer();
+
+    bool armed() const { return wheel != nullptr; }
+
+    std::function<void()> callback;
+    uint64_t interval = 0; // Milliseconds; when set the timer re-arms itself after firing
+
+private:
+    friend class TimerWheel;
+
+    TimerWheel *wheel = nullptr;
+    Timer *prev = nullptr;
+    Timer *next = nullptr;
+    uint64_t expires = 0; // Tick at which it fires
+    uint8_t level = 0;
+    uint8_t slot = 0;
+};
+
+// Hierarchical hashed timer wheel. Level 0 has one slot per tick; each
+// higher level has one slot per full turn of the level below, and its
+// timers cascade down as the wheel reaches them. Scheduling, cancelling and
+// firing are all O(1). Single-threaded: owned and driven by one loop.
+class TimerWheel
+{
+public:
+    explicit TimerWheel(uint64_t nowMs);
+    ~TimerWheel();
+
+    // (Re)arms timer to fire delayMs from now, rounded up to a whole tick
+    void schedule(Timer &timer, uint64_t delayMs);
+    void cancel(Timer &timer);
+
+    // Runs the callbacks of every timer due by nowMs
+    void advance(uint64_t nowMs);
+
+    // When advance() next has work to do, on the nowMs() clock, or 0 when no
+    // timer is armed. Never more than one level-0 turn away, so cascades
+    // happen on time.
+    uint64_t nextDueMs() const;
+
+    size_t size() const { return count; }
+
+    // CLOCK_MONOTONIC in milliseconds, the clock every caller should pass in
+    static uint64_t nowMs();
+
+private:
+    void insert(Timer &timer);
+    void unlink(Timer &timer);
+    void tick();
+
+    Timer *slots[WHEEL_LEVELS][WHEEL_SLOTS] = {};
+    uint64_t occupied[WHEEL_LEVELS] = {}; // Bit per non-empty slot
+    uint64_t current;                     // Last tick processed
+    size_t count = 0;
+};
+
+#endif
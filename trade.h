@@ -0,0 +1,96 @@
+#ifndef TRADE_H
+#define TRADE_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+class AccountBatch;
+
+// What a Trade asks for. Cancel and Replace act on a resting order of the
+// order book engine.
+enum class OrderAction : uint8_t
+{
+    New,
+    Cancel,
+    Replace // To amount_micros open at price_cents
+};
+
+// One BUY or SELL (or CANCEL/REPLACE) waiting to be executed, and its outcome
+struct Trade
+{
+    bool buy; // Cancel/Replace: set from the resting order
+    std::string symbol;
+    uint32_t symbol_id; // In the SymbolTable; the text is kept for logs and replies
+    int64_t amount_micros;
+    int64_t price_cents;
+    int user_id;
+    OrderAction action = OrderAction::New;
+    uint64_t target_id = 0; // Cancel/Replace: the resting order
+
+    // Filled in once the trade has been executed
+    uint64_t sequence = 0; // Global order trades were applied in, from 1
+    bool ok = false;
+    int64_t usd_cents = 0;
+    int64_t position_micros = 0;
+
+    // Only set by the order book engine
+    uint64_t order_id = 0; // A replace that kept its place keeps its ID
+    int64_t filled_micros = 0;
+    int64_t resting_micros = 0; // Left on the book
+};
+
+// Where a TradeEngine sends the balances a trade leaves behind: straight
+// into the open transaction, or onto a queue that is flushed later. Cash
+// is shared by every shard, so it is written as a change that commutes
+// with other shards' changes; a position belongs to one shard and is
+// written as its new value.
+class BalanceSink
+{
+public:
+    virtual ~BalanceSink() = default;
+
+    virtual bool addCash(int user_id, int64_t delta_cents) = 0;
+    virtual bool writePosition(int user_id, uint32_t symbol, int64_t micros) = 0; // 0 closes it
+};
+
+// Decides what a trade does to the accounts: settle it at the client's
+// price, or match it against resting orders on the other side. Only ever
+// called from the sequencer's engine thread.
+class TradeEngine
+{
+public:
+    virtual ~TradeEngine() = default;
+
+    // Checks trade against accounts and hands every balance it changes to
+    // sink before staging it in accounts. On false the engine itself is
+    // unchanged and any cash it reserved is released, but the caller must
+    // undo anything sink already wrote.
+    virtual bool run(Trade &trade, AccountBatch &accounts, BalanceSink &sink) = 0;
+
+    // Trades run since the last commit never reached the database; the
+    // caller discards their AccountBatch
+    virtual void rolledBack() {}
+
+    virtual void report(std::ostream &out) const = 0;
+};
+
+// Runs the trades of every worker thread, in sequence order on one thread,
+// against the account cache and persists them according to the persistence
+// mode
+class TradeExecutor
+{
+public:
+    virtual ~TradeExecutor() = default;
+
+    virtual void start() = 0;
+    virtual void stop() = 0; // Persists whatever is still queued first
+
+    // Returns trade.ok once the trade is as durable as the mode promises
+    virtual bool execute(Trade &trade) = 0;
+
+    // Mode and counters, one "name: value" per line
+    virtual void report(std::ostream &out) const = 0;
+};
+
+#endif
@@ -0,0 +1,665 @@
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include "uring_loop.h"
+
+// Tags carry the operation, the fd and the low bits of the connection id so
+// a late completion for a closed fd is not applied to a new client reusing it
+#define TAG_ID_BITS 24
+#define TAG_ID_MASK ((1u << TAG_ID_BITS) - 1)
+
+static int uringSetup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+}
+
+static int uringRegister(int fd, unsigned opcode, void *arg, unsigned nrArgs)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+}
+
+UringLoop::UringLoop(int listen_s, WorkerPool &workers, const LoopLimits &limits)
+    : ServerLoop(workers, limits), listen_s(listen_s)
+{
+}
+
+UringLoop::~UringLoop()
+{
+    for (auto &entry : connections)
+    {
+        close(entry.first);
+    }
+    connections.clear();
+
+    if (bufRingRegistered)
+    {
+        struct io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.bgid = 0;
+        uringRegister(ringFd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    }
+    if (ringFd >= 0)
+    {
+        close(ringFd);
+    }
+    if (sqes)
+    {
+        munmap(sqes, sqesSize);
+    }
+    if (ringMem)
+    {
+        munmap(ringMem, ringMemSize);
+    }
+    if (bufRing)
+    {
+        munmap(bufRing, bufRingSize);
+    }
+}
+
+uint64_t UringLoop::makeTag(Op op, int fd, uint64_t connId)
+{
+    return ((uint64_t)op << 56) | ((uint64_t)(uint32_t)fd << TAG_ID_BITS) | (connId & TAG_ID_MASK);
+}
+
+bool UringLoop::init()
+{
+    if (!completions.init() || !initTimers() || !setupRing() || !probeOps() || !setupBuffers() ||
+        !probeMultishot())
+    {
+        return false;
+    }
+
+    armAccept();
+    armPoll(OP_WAKEUP, completions.fd());
+    armPoll(OP_TIMER, timerFd());
+    return submit(0);
+}
+
+bool UringLoop::setupRing()
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    if ((ringFd = uringSetup(URING_ENTRIES, &params)) < 0)
+    {
+        perror("io_uring_setup failed");
+        return false;
+    }
+
+    // Both rings are mapped through one mmap below
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        std::cerr << "io_uring: kernel too old (no IORING_FEAT_SINGLE_MMAP)" << std::endl;
+        return false;
+    }
+
+    size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ringMemSize = sqSize > cqSize ? sqSize : cqSize;
+    ringMem = mmap(nullptr, ringMemSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (ringMem == MAP_FAILED)
+    {
+        ringMem = nullptr;
+        perror("io_uring ring mmap failed");
+        return false;
+    }
+
+    sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqeMem = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (sqeMem == MAP_FAILED)
+    {
+        perror("io_uring SQE mmap failed");
+        return false;
+    }
+    sqes = (struct io_uring_sqe *)sqeMem;
+
+    char *base = (char *)ringMem;
+    sqHead = (unsigned *)(base + params.sq_off.head);
+    sqTail = (unsigned *)(base + params.sq_off.tail);
+    sqArray = (unsigned *)(base + params.sq_off.array);
+    sqMask = *(unsigned *)(base + params.sq_off.ring_mask);
+    sqEntries = params.sq_entries;
+    sqTailLocal = *sqTail;
+    cqHead = (unsigned *)(base + params.cq_off.head);
+    cqTail = (unsigned *)(base + params.cq_off.tail);
+    cqMask = *(unsigned *)(base + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *)(base + params.cq_off.cqes);
+    return true;
+}
+
+bool UringLoop::probeOps()
+{
+    std::vector<char> mem(sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op));
+    struct io_uring_probe *probe = (struct io_uring_probe *)mem.data();
+    if (uringRegister(ringFd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) < 0)
+    {
+        perror("io_uring opcode probe failed");
+        return false;
+    }
+
+    static const struct
+    {
+        uint8_t op;
+        const char *name;
+    } needed[] = {
+        {IORING_OP_ACCEPT, "ACCEPT"},
+        {IORING_OP_RECV, "RECV"},
+        {IORING_OP_SENDMSG, "SENDMSG"},
+        {IORING_OP_POLL_ADD, "POLL_ADD"},
+        {IORING_OP_ASYNC_CANCEL, "ASYNC_CANCEL"},
+        {IORING_OP_CLOSE, "CLOSE"},
+        {IORING_OP_TIMEOUT, "TIMEOUT"},
+    };
+    for (const auto &op : needed)
+    {
+        if (op.op > probe->last_op || !(probe->ops[op.op].flags & IO_URING_OP_SUPPORTED))
+        {
+            std::cerr << "io_uring: kernel lacks IORING_OP_" << op.name << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool UringLoop::probeMultishot()
+{
+    // The opcode probe cannot tell whether ACCEPT and RECV take their
+    // multishot flags, and an old kernel just fails each request with
+    // -EINVAL, which would drop every client. Run one multishot recv on a
+    // socketpair instead: a byte then EOF gives a completion flagged
+    // IORING_CQE_F_MORE followed by a final one only if multishot works.
+    // Multishot recv came after multishot accept, so this covers both.
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0)
+    {
+        perror("io_uring multishot probe: socketpair failed");
+        return false;
+    }
+    bool ready = send(pair[1], "x", 1, MSG_NOSIGNAL) == 1 && shutdown(pair[1], SHUT_WR) == 0;
+
+    bool multishot = false;
+    bool done = !ready;
+    if (ready)
+    {
+        struct io_uring_sqe *sqe = getSqe();
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = pair[0];
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = 0;
+        sqe->user_data = makeTag(OP_PROBE, pair[0], 0);
+    }
+
+    // Nothing else is armed yet, so every completion here is the probe's
+    bool first = true;
+    while (!done && submit(1))
+    {
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        while (head != tail && !done)
+        {
+            struct io_uring_cqe cqe = cqes[head & cqMask];
+            head++;
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+            if (cqe.res > 0 && (cqe.flags & IORING_CQE_F_BUFFER))
+            {
+                recycleBuffer((uint16_t)(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+            }
+            if (first)
+            {
+                multishot = cqe.res == 1 && (cqe.flags & IORING_CQE_F_MORE);
+                first = false;
+            }
+            done = !(cqe.flags & IORING_CQE_F_MORE);
+        }
+    }
+    close(pair[0]);
+    close(pair[1]);
+
+    if (!multishot)
+    {
+        std::cerr << "io_uring: kernel lacks multishot recv" << std::endl;
+    }
+    return multishot;
+}
+
+bool UringLoop::setupBuffers()
+{
+    bufRingSize = URING_BUFFER_COUNT * sizeof(struct io_uring_buf);
+    void *mem = mmap(nullptr, bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        perror("io_uring buffer ring mmap failed");
+        return false;
+    }
+    bufRing = (struct io_uring_buf_ring *)mem;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)bufRing;
+    reg.ring_entries = URING_BUFFER_COUNT;
+    reg.bgid = 0;
+    if (uringRegister(ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        perror("io_uring buffer ring registration failed");
+        return false;
+    }
+    bufRingRegistered = true;
+
+    bufferPool.resize((size_t)URING_BUFFER_COUNT * READ_CHUNK);
+    for (uint16_t bid = 0; bid < URING_BUFFER_COUNT; bid++)
+    {
+        recycleBuffer(bid);
+    }
+    return true;
+}
+
+void UringLoop::recycleBuffer(uint16_t bid)
+{
+    // The ring is an array of io_uring_buf whose first entry overlays the
+    // tail. Index it directly: in C++ the header's flexible bufs member is
+    // not at offset 0.
+    struct io_uring_buf *bufs = (struct io_uring_buf *)bufRing;
+    struct io_uring_buf *buf = &bufs[bufTail & (URING_BUFFER_COUNT - 1)];
+    buf->addr = (uint64_t)(uintptr_t)&bufferPool[(size_t)bid * READ_CHUNK];
+    buf->len = READ_CHUNK;
+    buf->bid = bid;
+    bufTail++;
+    __atomic_store_n(&bufRing->tail, bufTail, __ATOMIC_RELEASE);
+}
+
+struct io_uring_sqe *UringLoop::getSqe()
+{
+    // Ring full: push what we have to the kernel to make room
+    if (sqTailLocal - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries)
+    {
+        submit(0);
+    }
+
+    unsigned index = sqTailLocal & sqMask;
+    struct io_uring_sqe *sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray[index] = index;
+    sqTailLocal++;
+    pendingSubmits++;
+    return sqe;
+}
+
+bool UringLoop::submit(unsigned waitFor)
+{
+    __atomic_store_n(sqTail, sqTailLocal, __ATOMIC_RELEASE);
+
+    unsigned flags = waitFor > 0 ? IORING_ENTER_GETEVENTS : 0;
+    if (pendingSubmits == 0 && waitFor == 0)
+    {
+        return true;
+    }
+
+    int rc = uringEnter(ringFd, pendingSubmits, waitFor, flags);
+    if (rc < 0)
+    {
+        if (errno == EINTR)
+        {
+            return true;
+        }
+        perror("io_uring_enter failed");
+        return false;
+    }
+    pendingSubmits -= (unsigned)rc < pendingSubmits ? (unsigned)rc : pendingSubmits;
+    return true;
+}
+
+void UringLoop::armAccept()
+{
+    struct io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_s;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = makeTag(OP_ACCEPT, listen_s, 0);
+}
+
+void UringLoop::armRecv(const Connection &conn)
+{
+    struct io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn.fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = makeTag(OP_RECV, conn.fd, conn.id);
+}
+
+void UringLoop::armPoll(Op op, int fd)
+{
+    // The completion eventfd and the timerfd are polled like any other socket
+    struct io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = makeTag(op, fd, 0);
+}
+
+void UringLoop::submitSend(const Connection &conn, InFlightSend &send)
+{
+    memset(&send.msg, 0, sizeof(send.msg));
+    send.msg.msg_iov = send.iov;
+    send.msg.msg_iovlen = send.data.gather(send.iov, MAX_IOV);
+
+    struct io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = conn.fd;
+    sqe->addr = (uint64_t)(uintptr_t)&send.msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = makeTag(OP_SEND, conn.fd, conn.id);
+}
+
+bool UringLoop::flushOutput(Connection &conn)
+{
+    if (conn.output.empty())
+    {
+        return true;
+    }
+
+    // One send per connection at a time; output queued meanwhile goes out
+    // together in the next one
+    uint64_t tag = makeTag(OP_SEND, conn.fd, conn.id);
+    if (sendsInFlight.count(tag))
+    {
+        return true;
+    }
+
+    std::unique_ptr<InFlightSend> &send = sendsInFlight[tag];
+    send = std::make_unique<InFlightSend>();
+    send->data.swap(conn.output);
+    submitSend(conn, *send);
+    return true;
+}
+
+bool UringLoop::writePending(const Connection &conn) const
+{
+    return sendsInFlight.count(makeTag(OP_SEND, conn.fd, conn.id)) > 0;
+}
+
+size_t UringLoop::unsentBytes(const Connection &conn) const
+{
+    auto sent = sendsInFlight.find(makeTag(OP_SEND, conn.fd, conn.id));
+    size_t inFlight = sent == sendsInFlight.end() ? 0 : sent->second->data.size();
+    return conn.output.size() + inFlight;
+}
+
+void UringLoop::pauseReading(Connection &conn)
+{
+    // Cancel the multishot recv so the kernel stops filling buffers for us;
+    // its final -ECANCELED completion is ignored in onRecv()
+    struct io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = makeTag(OP_RECV, conn.fd, conn.id);
+    sqe->user_data = makeTag(OP_CANCEL, conn.fd, conn.id);
+}
+
+void UringLoop::resumeReading(Connection &conn)
+{
+    armRecv(conn);
+}
+
+void UringLoop::closeConnection(int fd)
+{
+    auto it = connections.find(fd);
+    if (it == connections.end())
+    {
+        return;
+    }
+
+    // Cancel the multishot recv and any send, then close. The hard link
+    // keeps the close even when there was nothing left to cancel.
+    struct io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    sqe->flags = IOSQE_IO_HARDLINK;
+    sqe->user_data = makeTag(OP_CANCEL, fd, it->second.id);
+
+    sqe = getSqe();
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = fd;
+    sqe->user_data = makeTag(OP_CLOSE, fd, it->second.id);
+
+    connections.erase(it);
+}
+
+Connection *UringLoop::findConnection(int fd, uint32_t idTag)
+{
+    auto it = connections.find(fd);
+    if (it == connections.end() || (it->second.id & TAG_ID_MASK) != idTag)
+    {
+        return nullptr;
+    }
+    return &it->second;
+}
+
+void UringLoop::run()
+{
+    while (!shutdownRequested)
+    {
+        // Submit everything queued during the last pass and wait for work
+        rearmTimers();
+        if (!submit(1))
+        {
+            break;
+        }
+
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        while (head != tail && !shutdownRequested)
+        {
+            struct io_uring_cqe cqe = cqes[head & cqMask];
+            head++;
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+            handleCqe(cqe);
+        }
+    }
+
+    drainSends();
+    std::cout << "Shutting down the server..." << std::endl;
+}
+
+void UringLoop::drainSends()
+{
+    // Sends and closes are only queued as SQEs, so replies finished just
+    // before SHUTDOWN would die with the ring. Push them out and reap
+    // their completions, for at most URING_DRAIN_MS.
+    for (auto &entry : connections)
+    {
+        flushOutput(entry.second);
+    }
+
+    struct __kernel_timespec limit;
+    limit.tv_sec = URING_DRAIN_MS / 1000;
+    limit.tv_nsec = (long long)(URING_DRAIN_MS % 1000) * 1000000;
+    struct io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->addr = (uint64_t)(uintptr_t)&limit;
+    sqe->len = 1;
+    sqe->user_data = makeTag(OP_DRAIN, 0, 0);
+
+    // Only sends are handled now; a completed one also flushes whatever
+    // queued up behind it
+    bool expired = false;
+    while (!sendsInFlight.empty() && !expired && submit(1))
+    {
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        while (head != tail)
+        {
+            struct io_uring_cqe cqe = cqes[head & cqMask];
+            head++;
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+
+            Op op = (Op)(cqe.user_data >> 56);
+            if (op == OP_SEND)
+            {
+                handleCqe(cqe);
+            }
+            expired = expired || op == OP_DRAIN;
+        }
+    }
+    submit(0); // Closes queued by failed sends
+}
+
+void UringLoop::handleCqe(const struct io_uring_cqe &cqe)
+{
+    Op op = (Op)(cqe.user_data >> 56);
+    int fd = (int)(uint32_t)(cqe.user_data >> TAG_ID_BITS);
+    uint32_t idTag = (uint32_t)(cqe.user_data & TAG_ID_MASK);
+
+    switch (op)
+    {
+    case OP_ACCEPT:
+        onAccept(cqe.res, cqe.flags);
+        break;
+    case OP_RECV:
+        onRecv(fd, idTag, cqe.res, cqe.flags);
+        break;
+    case OP_SEND:
+        onSend(cqe.user_data, fd, idTag, cqe.res);
+        break;
+    case OP_WAKEUP:
+        if (!(cqe.flags & IORING_CQE_F_MORE))
+        {
+            armPoll(OP_WAKEUP, completions.fd());
+        }
+        handleCompletions();
+        break;
+    case OP_TIMER:
+        if (!(cqe.flags & IORING_CQE_F_MORE))
+        {
+            armPoll(OP_TIMER, timerFd());
+        }
+        handleTimers();
+        break;
+    case OP_CANCEL:
+    case OP_CLOSE:
+    case OP_PROBE:
+    case OP_DRAIN:
+        break;
+    }
+}
+
+void UringLoop::onAccept(int res, uint32_t flags)
+{
+    if (res >= 0 && admitConnection(res))
+    {
+        armRecv(addConnection(res));
+    }
+    else if (res >= 0)
+    {
+        close(res);
+    }
+    else
+    {
+        std::cerr << "Accept failed: " << strerror(-res) << std::endl;
+    }
+
+    // The kernel drops a multishot accept on some errors; re-arm it
+    if (!(flags & IORING_CQE_F_MORE))
+    {
+        armAccept();
+    }
+}
+
+void UringLoop::onRecv(int fd, uint32_t idTag, int res, uint32_t flags)
+{
+    Connection *conn = findConnection(fd, idTag);
+
+    if (res > 0 && (flags & IORING_CQE_F_BUFFER))
+    {
+        uint16_t bid = (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+        if (conn)
+        {
+            conn->input.append(&bufferPool[(size_t)bid * READ_CHUNK], res);
+        }
+        recycleBuffer(bid);
+    }
+
+    if (!conn)
+    {
+        return;
+    }
+
+    if (res == 0)
+    {
+        conn->peerClosed = true;
+        finishIfDone(*conn);
+        return;
+    }
+    if (res == -ECANCELED)
+    {
+        return; // Paused by backpressure; resumeReading() re-arms
+    }
+    if (res < 0 && res != -ENOBUFS)
+    {
+        std::cout << "Client disconnected.\n";
+        closeConnection(fd);
+        return;
+    }
+
+    // Out of buffers or the kernel ended the multishot: ask again
+    bool rearm = !(flags & IORING_CQE_F_MORE);
+    if (res > 0)
+    {
+        handleInput(*conn);
+        conn = findConnection(fd, idTag);
+    }
+    if (conn && rearm && !conn->peerClosed && !conn->readPaused)
+    {
+        armRecv(*conn);
+    }
+}
+
+void UringLoop::onSend(uint64_t tag, int fd, uint32_t idTag, int res)
+{
+    auto sent = sendsInFlight.find(tag);
+    if (sent == sendsInFlight.end())
+    {
+        return;
+    }
+
+    Connection *conn = findConnection(fd, idTag);
+    if (!conn || res < 0)
+    {
+        sendsInFlight.erase(sent);
+        if (conn)
+        {
+            closeConnection(fd);
+        }
+        return;
+    }
+
+    // Short send: resubmit the rest of the same output
+    sent->second->data.consume((size_t)res);
+    if (!sent->second->data.empty())
+    {
+        submitSend(*conn, *sent->second);
+        return;
+    }
+
+    sendsInFlight.erase(sent);
+    flushOutput(*conn);
+    if (!shutdownRequested)
+    {
+        handleWritten(*conn); // May start more work, so not while draining
+    }
+}
@@ -0,0 +1,116 @@
+#ifndef URING_LOOP_H
+#define URING_LOOP_H
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+#include "server_loop.h"
+
+#define URING_ENTRIES 256
+#define URING_BUFFER_COUNT 256 // Must be a power of two
+#define URING_DRAIN_MS 1000     // How long shutdown waits for queued replies to go out
+
+// io_uring implementation of the server loop. One multishot accept feeds new
+// clients, each client gets a multishot recv that fills buffers from a ring
+// registered with the kernel, and gathered sendmsg/close requests are queued
+// as SQEs. Everything
+// queued during one pass is submitted with a single io_uring_enter() call.
+class UringLoop : public ServerLoop
+{
+public:
+    UringLoop(int listen_s, WorkerPool &workers, const LoopLimits &limits);
+    ~UringLoop() override;
+
+    // Fails (so the caller can fall back to epoll) when the kernel lacks
+    // io_uring, one of the opcodes used here, provided buffer rings or
+    // multishot recv
+    bool init() override;
+    void run() override;
+
+protected:
+    bool flushOutput(Connection &conn) override;
+    bool writePending(const Connection &conn) const override;
+    size_t unsentBytes(const Connection &conn) const override;
+    void pauseReading(Connection &conn) override;
+    void resumeReading(Connection &conn) override;
+    void closeConnection(int fd) override;
+
+private:
+    enum Op : uint8_t
+    {
+        OP_ACCEPT = 1,
+        OP_RECV,
+        OP_SEND,
+        OP_CANCEL,
+        OP_CLOSE,
+        OP_WAKEUP,
+        OP_TIMER,
+        OP_PROBE,
+        OP_DRAIN
+    };
+
+    bool setupRing();
+    bool probeOps();
+    bool setupBuffers();
+    bool probeMultishot();
+    struct io_uring_sqe *getSqe();
+    bool submit(unsigned waitFor);
+
+    void armAccept();
+    void armRecv(const Connection &conn);
+    void armPoll(Op op, int fd);
+    struct InFlightSend;
+    void submitSend(const Connection &conn, InFlightSend &send);
+    void recycleBuffer(uint16_t bid);
+
+    void drainSends();
+    void handleCqe(const struct io_uring_cqe &cqe);
+    void onAccept(int res, uint32_t flags);
+    void onRecv(int fd, uint32_t idTag, int res, uint32_t flags);
+    void onSend(uint64_t tag, int fd, uint32_t idTag, int res);
+    Connection *findConnection(int fd, uint32_t idTag);
+
+    static uint64_t makeTag(Op op, int fd, uint64_t connId);
+
+    int listen_s;
+    int ringFd = -1;
+
+    // Submission and completion rings shared with the kernel
+    void *ringMem = nullptr;
+    size_t ringMemSize = 0;
+    struct io_uring_sqe *sqes = nullptr;
+    size_t sqesSize = 0;
+    unsigned *sqHead = nullptr;
+    unsigned *sqTail = nullptr;
+    unsigned *sqArray = nullptr;
+    unsigned sqMask = 0;
+    unsigned sqEntries = 0;
+    unsigned sqTailLocal = 0;
+    unsigned pendingSubmits = 0;
+    unsigned *cqHead = nullptr;
+    unsigned *cqTail = nullptr;
+    unsigned cqMask = 0;
+    struct io_uring_cqe *cqes = nullptr;
+
+    // Receive buffers the kernel picks from for multishot recv
+    struct io_uring_buf_ring *bufRing = nullptr;
+    size_t bufRingSize = 0;
+    std::vector<char> bufferPool;
+    uint16_t bufTail = 0;
+    bool bufRingRegistered = false;
+
+    // Output handed to an in-flight sendmsg. It stays alive here until the
+    // send completes, even if the connection closes first.
+    struct InFlightSend
+    {
+        OutputQueue data;
+        struct msghdr msg;
+        struct iovec iov[MAX_IOV];
+    };
+    std::unordered_map<uint64_t, std::unique_ptr<InFlightSend>> sendsInFlight; // By send tag
+};
+
+#endif
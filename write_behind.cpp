@@ -0,0 +1,253 @@
+#include <iostream>
+#include "write_behind.h"
+#include "account_cache.h"
+#include "database.h"
+#include "db_pool.h"
+#include "sequencer.h"
+#include "symbol_table.h"
+
+WriteBehindFlusher::WriteBehindFlusher(DbPool &db, AccountCache &accounts, const SymbolTable &symbols,
+                                       TradeEngine &engine, Sequencer &sequencer,
+                                       uint64_t intervalMs, size_t flushBatch, size_t queueMax)
+    : db(db), accounts(accounts), symbols(symbols), engine(engine), sequencer(sequencer), intervalMs(intervalMs > 0 ? intervalMs : 1),
+      flushBatch(flushBatch > 0 ? flushBatch : 1), queueMax(queueMax > 0 ? queueMax : 1)
+{
+}
+
+WriteBehindFlusher::~WriteBehindFlusher()
+{
+    stop();
+}
+
+void WriteBehindFlusher::start()
+{
+    thread = std::thread(&WriteBehindFlusher::flusherMain, this);
+    sequencer.start([this](std::vector<Trade *> &trades)
+                    { applyTrades(trades); },
+                    sequencer.capacity(), 0);
+    std::cout << "Write-behind: flushing every " << intervalMs << "ms or " << flushBatch
+              << " change(s), at most " << queueMax << " pending" << std::endl;
+}
+
+void WriteBehindFlusher::stop()
+{
+    sequencer.stop(); // No more changes after this
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+    }
+    wake.notify_all();
+    if (thread.joinable())
+    {
+        thread.join();
+    }
+}
+
+bool WriteBehindFlusher::execute(Trade &trade)
+{
+    return sequencer.submit(trade);
+}
+
+void WriteBehindFlusher::applyTrades(std::vector<Trade *> &trades)
+{
+    // Queueing cannot fail, so a trade that passes its checks is done
+    for (Trade *trade : trades)
+    {
+        AccountBatch batch(accounts);
+        trade->ok = engine.run(*trade, batch, *this);
+        if (trade->ok)
+        {
+            batch.publish();
+        }
+        else
+        {
+            batch.discard();
+            trade->usd_cents = 0;
+            trade->position_micros = 0;
+        }
+    }
+    tradeCount.fetch_add(trades.size(), std::memory_order_relaxed);
+}
+
+bool WriteBehindFlusher::addCash(int user_id, int64_t delta_cents)
+{
+    queueChange(user_id, SYMBOL_NONE, delta_cents);
+    return true;
+}
+
+bool WriteBehindFlusher::writePosition(int user_id, uint32_t symbol, int64_t micros)
+{
+    queueChange(user_id, symbol, micros);
+    return true;
+}
+
+void WriteBehindFlusher::queueChange(int user_id, uint32_t symbol, int64_t value)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    queuedCount.fetch_add(1, std::memory_order_relaxed);
+
+    auto it = pending.find(balanceKey(user_id, symbol));
+    if (it != pending.end())
+    {
+        // Keeps the older queuedAt
+        if (symbol == SYMBOL_NONE)
+        {
+            it->second.value += value;
+        }
+        else
+        {
+            it->second.value = value;
+        }
+        coalescedCount.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (pending.size() >= queueMax)
+    {
+        if (droppedCount.fetch_add(1, std::memory_order_relaxed) == 0)
+        {
+            std::cerr << "Write-behind queue full (" << queueMax << " changes); dropping changes" << std::endl;
+        }
+        return;
+    }
+    pending.emplace(balanceKey(user_id, symbol), Change{value, Clock::now()});
+    if (pending.size() == flushBatch)
+    {
+        wake.notify_one();
+    }
+}
+
+void WriteBehindFlusher::flusherMain()
+{
+    std::map<Key, Change> changes;
+    std::unique_lock<std::mutex> lock(mtx);
+    while (true)
+    {
+        wake.wait_for(lock, std::chrono::milliseconds(intervalMs), [this]
+                      { return stopping || pending.size() >= flushBatch; });
+        if (pending.empty())
+        {
+            if (stopping)
+            {
+                return; // Drained
+            }
+            continue;
+        }
+
+        changes.swap(pending);
+        bool last = stopping;
+        lock.unlock();
+        bool ok = flush(changes);
+        lock.lock();
+
+        if (!ok && last)
+        {
+            // No later flush to retry in
+            droppedCount.fetch_add(changes.size(), std::memory_order_relaxed);
+            std::cerr << "Write-behind: " << changes.size() << " change(s) lost at shutdown" << std::endl;
+        }
+        else if (!ok)
+        {
+            // Requeue for the next attempt. A position queued meanwhile is
+            // newer; a cash change queued meanwhile comes on top of this one.
+            for (auto &change : changes)
+            {
+                auto it = pending.find(change.first);
+                if (it == pending.end())
+                {
+                    pending.emplace(change.first, change.second);
+                    continue;
+                }
+                if (balanceSymbol(change.first) == SYMBOL_NONE)
+                {
+                    it->second.value += change.second.value;
+                }
+                if (change.second.queuedAt < it->second.queuedAt)
+                {
+                    it->second.queuedAt = change.second.queuedAt;
+                }
+            }
+
+            // Give the database an interval before trying again
+            wake.wait_for(lock, std::chrono::milliseconds(intervalMs), [this]
+                          { return stopping; });
+        }
+        changes.clear();
+    }
+}
+
+bool WriteBehindFlusher::flush(std::map<Key, Change> &changes)
+{
+    DbLease lease(db, DbRole::Writer);
+    if (!lease.ok())
+    {
+        failedFlushCount.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    DbConnection &conn = lease.connection();
+
+    bool ok = conn.statements.exec(conn.db, "BEGIN IMMEDIATE;") == SQLITE_OK;
+    for (auto it = changes.begin(); ok && it != changes.end(); ++it)
+    {
+        int user_id = balanceUser(it->first);
+        uint32_t symbol = balanceSymbol(it->first);
+        ok = symbol == SYMBOL_NONE ? addUserCash(conn, user_id, it->second.value)
+                                   : writeUserPosition(conn, symbols.symbol(symbol), symbols.name(symbol),
+                                                       user_id, it->second.value);
+    }
+    if (ok && conn.statements.exec(conn.db, "COMMIT;") != SQLITE_OK)
+    {
+        ok = false;
+    }
+    if (!ok)
+    {
+        std::cerr << "Write-behind flush of " << changes.size() << " change(s) failed: " << sqlite3_errmsg(conn.db) << std::endl;
+        conn.statements.exec(conn.db, "ROLLBACK;");
+        failedFlushCount.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    Clock::time_point now = Clock::now();
+    for (auto &change : changes)
+    {
+        uint64_t lagUs = std::chrono::duration_cast<std::chrono::microseconds>(now - change.second.queuedAt).count();
+        uint64_t seen = maxLagUs.load(std::memory_order_relaxed);
+        while (lagUs > seen && !maxLagUs.compare_exchange_weak(seen, lagUs, std::memory_order_relaxed))
+        {
+        }
+    }
+    flushedCount.fetch_add(changes.size(), std::memory_order_relaxed);
+    flushCount.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void WriteBehindFlusher::report(std::ostream &out) const
+{
+    size_t waiting;
+    uint64_t oldestUs = 0;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        waiting = pending.size();
+        Clock::time_point now = Clock::now();
+        for (auto &change : pending)
+        {
+            uint64_t ageUs = std::chrono::duration_cast<std::chrono::microseconds>(now - change.second.queuedAt).count();
+            if (ageUs > oldestUs)
+            {
+                oldestUs = ageUs;
+            }
+        }
+    }
+
+    out << "Persistence: write-behind\n"
+        << "Trades: " << tradeCount.load(std::memory_order_relaxed) << "\n"
+        << "Pending changes: " << waiting << " (oldest " << oldestUs << "us)\n"
+        << "Changes queued: " << queuedCount.load(std::memory_order_relaxed)
+        << ", coalesced: " << coalescedCount.load(std::memory_order_relaxed)
+        << ", flushed: " << flushedCount.load(std::memory_order_relaxed)
+        << ", dropped: " << droppedCount.load(std::memory_order_relaxed) << "\n"
+        << "Flushes: " << flushCount.load(std::memory_order_relaxed)
+        << " (" << failedFlushCount.load(std::memory_order_relaxed) << " failed)\n"
+        << "Max lag: " << maxLagUs.load(std::memory_order_relaxed) << "us\n";
+    sequencer.report(out);
+    engine.report(out);
+}
@@ -0,0 +1,89 @@
+#ifndef WRITE_BEHIND_H
+#define WRITE_BEHIND_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "trade.h"
+
+class DbPool;
+class AccountCache;
+class Sequencer;
+class SymbolTable;
+
+// Write-behind persistence, for simulation and paper trading. Trades run
+// against the account cache on the Sequencer's engine thread and are
+// answered at once; the balances they leave behind are queued and a
+// background thread writes them to SQLite every intervalMs, or as soon as
+// flushBatch of them are waiting. Queued
+// changes are keyed by (user, symbol ID), so a later change to the same
+// balance is folded into the pending one instead of queueing behind it: a
+// position's new value replaces the old, cash changes add up.
+// Changes that do not fit in queueMax are dropped and counted; a crash
+// loses whatever is still pending. stop() flushes everything first.
+class WriteBehindFlusher : public TradeExecutor, private BalanceSink
+{
+public:
+    WriteBehindFlusher(DbPool &db, AccountCache &accounts, const SymbolTable &symbols, TradeEngine &engine,
+                       Sequencer &sequencer, uint64_t intervalMs, size_t flushBatch, size_t queueMax);
+    ~WriteBehindFlusher();
+
+    void start() override;
+    void stop() override;
+
+    // Runs the trade against the cache and queues its changes; returns trade.ok
+    bool execute(Trade &trade) override;
+
+    void report(std::ostream &out) const override;
+
+private:
+    using Clock = std::chrono::steady_clock;
+    using Key = uint64_t; // balanceKey(); symbol SYMBOL_NONE is the cash balance
+
+    struct Change
+    {
+        int64_t value; // Change to the cash balance, or the position's new value
+        Clock::time_point queuedAt; // Of the oldest change not yet written
+    };
+
+    void applyTrades(std::vector<Trade *> &trades); // On the sequencer's engine thread
+
+    bool addCash(int user_id, int64_t delta_cents) override;
+    bool writePosition(int user_id, uint32_t symbol, int64_t micros) override;
+    void queueChange(int user_id, uint32_t symbol, int64_t value);
+
+    void flusherMain();
+    bool flush(std::map<Key, Change> &changes);
+
+    DbPool &db;
+    AccountCache &accounts;
+    const SymbolTable &symbols;
+    TradeEngine &engine;
+    Sequencer &sequencer;
+    uint64_t intervalMs;
+    size_t flushBatch;
+    size_t queueMax;
+
+    mutable std::mutex mtx;
+    std::condition_variable wake; // Flusher waits for the interval, a full batch or stop
+    std::map<Key, Change> pending;
+    bool stopping = false;
+    std::thread thread;
+
+    std::atomic<uint64_t> tradeCount{0};
+    std::atomic<uint64_t> queuedCount{0};    // Changes handed to the queue
+    std::atomic<uint64_t> coalescedCount{0}; // ...that replaced one already pending
+    std::atomic<uint64_t> droppedCount{0};   // ...that were never written
+    std::atomic<uint64_t> flushedCount{0};   // Changes written to SQLite
+    std::atomic<uint64_t> flushCount{0};
+    std::atomic<uint64_t> failedFlushCount{0};
+    std::atomic<uint64_t> maxLagUs{0}; // Longest a change waited to be written
+};
+
+#endif